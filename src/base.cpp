@@ -1,124 +1,168 @@
 #include "base.h"
 
-#define GLM_ENABLE_EXPERIMENTAL
-
-#include <glm/gtx/hash.hpp>
-#include <map>
-#include <unordered_map>
+#include <algorithm>
 
 void AddBase(
     std::vector<glm::vec3> &points,
     std::vector<glm::ivec3> &triangles,
+    const std::vector<int> &boundary,
     const int w, const int h, const float z)
 {
     const int w1 = w - 1;
     const int h1 = h - 1;
+    const int n = boundary.size();
+    if (n < 3) {
+        return;
+    }
 
-    std::map<int, float> x0s;
-    std::map<int, float> x1s;
-    std::map<int, float> y0s;
-    std::map<int, float> y1s;
-    std::unordered_map<glm::vec3, int> lookup;
-
-    // find points along each edge
-    for (int i = 0; i < points.size(); i++) {
-        const auto &p = points[i];
-        bool edge = false;
-        if (p.x == 0) {
-            x0s[p.y] = p.z;
-            edge = true;
-        } else if (p.x == w1) {
-            x1s[p.y] = p.z;
-            edge = true;
-        }
-        if (p.y == 0) {
-            y0s[p.x] = p.z;
-            edge = true;
-        } else if (p.y == h1) {
-            y1s[p.x] = p.z;
-            edge = true;
-        }
-        if (edge) {
-            lookup[p] = i;
+    // start the walk at the (0, 0) corner, so that each edge of the
+    // heightmap is a single run of the boundary
+    int start = 0;
+    for (int i = 0; i < n; i++) {
+        const glm::vec3 &p = points[boundary[i]];
+        if (p.x == 0 && p.y == 0) {
+            start = i;
+            break;
         }
     }
 
-    std::vector<std::pair<int, float>> sx0s(x0s.begin(), x0s.end());
-    std::vector<std::pair<int, float>> sx1s(x1s.begin(), x1s.end());
-    std::vector<std::pair<int, float>> sy0s(y0s.begin(), y0s.end());
-    std::vector<std::pair<int, float>> sy1s(y1s.begin(), y1s.end());
+    // compute base center point, followed by one base point below each
+    // boundary point
+    points.reserve(points.size() + n + 1);
+    const int center = points.size();
+    points.emplace_back(w * 0.5f, h * 0.5f, z);
+    const int base = points.size();
+    for (int i = 0; i < n; i++) {
+        const glm::vec3 &p = points[boundary[(start + i) % n]];
+        points.emplace_back(p.x, p.y, z);
+    }
 
-    const auto pointIndex = [&lookup, &points](
-        const float x, const float y, const float z)
-    {
-        const glm::vec3 point(x, y, z);
-        if (lookup.find(point) == lookup.end()) {
-            lookup[point] = points.size();
-            points.push_back(point);
+    // segments along each edge (x = 0, x = w1, y = 0, y = h1), as pairs
+    // of boundary positions ordered by increasing coordinate
+    std::vector<std::pair<int, int>> edges[4];
+    for (int i = 0; i < n; i++) {
+        const int j = (i + 1) % n;
+        const glm::vec3 &p = points[base + i];
+        const glm::vec3 &q = points[base + j];
+        int edge;
+        if (p.x == 0 && q.x == 0) {
+            edge = 0;
+        } else if (p.x == w1 && q.x == w1) {
+            edge = 1;
+        } else if (p.y == 0 && q.y == 0) {
+            edge = 2;
+        } else if (p.y == h1 && q.y == h1) {
+            edge = 3;
+        } else {
+            continue;
         }
-        return lookup[point];
-    };
+        const bool ascending = edge < 2 ? p.y < q.y : p.x < q.x;
+        edges[edge].emplace_back(ascending ? i : j, ascending ? j : i);
+    }
+    // each run follows the direction of the boundary, which may go
+    // against the coordinate
+    for (int edge = 0; edge < 4; edge++) {
+        auto &segments = edges[edge];
+        const auto coordinate = [&](const int i) {
+            const glm::vec3 &p = points[base + i];
+            return edge < 2 ? p.y : p.x;
+        };
+        if (segments.size() > 1 &&
+            coordinate(segments.front().first) >
+            coordinate(segments.back().first))
+        {
+            std::reverse(segments.begin(), segments.end());
+        }
+    }
 
-    // compute base center point
-    const int center = pointIndex(w * 0.5f, h * 0.5f, z);
+    triangles.reserve(triangles.size() + n * 3);
+    const auto top = [&boundary, start, n](const int i) {
+        return boundary[(start + i) % n];
+    };
 
     // edge x = 0
-    for (int i = 1; i < sx0s.size(); i++) {
-        const int y0 = sx0s[i-1].first;
-        const int y1 = sx0s[i].first;
-        const float z0 = sx0s[i-1].second;
-        const float z1 = sx0s[i].second;
-        const int p00 = pointIndex(0, y0, z);
-        const int p01 = pointIndex(0, y0, z0);
-        const int p10 = pointIndex(0, y1, z);
-        const int p11 = pointIndex(0, y1, z1);
+    for (const auto &s : edges[0]) {
+        const int p00 = base + s.first;
+        const int p01 = top(s.first);
+        const int p10 = base + s.second;
+        const int p11 = top(s.second);
         triangles.emplace_back(p01, p10, p00);
         triangles.emplace_back(p01, p11, p10);
         triangles.emplace_back(center, p00, p10);
     }
 
     // edge x = w1
-    for (int i = 1; i < sx1s.size(); i++) {
-        const int y0 = sx1s[i-1].first;
-        const int y1 = sx1s[i].first;
-        const float z0 = sx1s[i-1].second;
-        const float z1 = sx1s[i].second;
-        const int p00 = pointIndex(w1, y0, z);
-        const int p01 = pointIndex(w1, y0, z0);
-        const int p10 = pointIndex(w1, y1, z);
-        const int p11 = pointIndex(w1, y1, z1);
+    for (const auto &s : edges[1]) {
+        const int p00 = base + s.first;
+        const int p01 = top(s.first);
+        const int p10 = base + s.second;
+        const int p11 = top(s.second);
         triangles.emplace_back(p00, p10, p01);
         triangles.emplace_back(p10, p11, p01);
         triangles.emplace_back(center, p10, p00);
     }
 
     // edge y = 0
-    for (int i = 1; i < sy0s.size(); i++) {
-        const int x0 = sy0s[i-1].first;
-        const int x1 = sy0s[i].first;
-        const float z0 = sy0s[i-1].second;
-        const float z1 = sy0s[i].second;
-        const int p00 = pointIndex(x0, 0, z);
-        const int p01 = pointIndex(x0, 0, z0);
-        const int p10 = pointIndex(x1, 0, z);
-        const int p11 = pointIndex(x1, 0, z1);
+    for (const auto &s : edges[2]) {
+        const int p00 = base + s.first;
+        const int p01 = top(s.first);
+        const int p10 = base + s.second;
+        const int p11 = top(s.second);
         triangles.emplace_back(p00, p10, p01);
         triangles.emplace_back(p10, p11, p01);
         triangles.emplace_back(center, p10, p00);
     }
 
     // edge y = h1
-    for (int i = 1; i < sy1s.size(); i++) {
-        const int x0 = sy1s[i-1].first;
-        const int x1 = sy1s[i].first;
-        const float z0 = sy1s[i-1].second;
-        const float z1 = sy1s[i].second;
-        const int p00 = pointIndex(x0, h1, z);
-        const int p01 = pointIndex(x0, h1, z0);
-        const int p10 = pointIndex(x1, h1, z);
-        const int p11 = pointIndex(x1, h1, z1);
+    for (const auto &s : edges[3]) {
+        const int p00 = base + s.first;
+        const int p01 = top(s.first);
+        const int p10 = base + s.second;
+        const int p11 = top(s.second);
         triangles.emplace_back(p01, p10, p00);
         triangles.emplace_back(p01, p11, p10);
         triangles.emplace_back(center, p00, p10);
     }
 }
+
+SkirtMesh::SkirtMesh(
+    std::unique_ptr<Mesh> mesh,
+    const std::vector<int> &boundary,
+    const float depth) :
+    m_Mesh(std::move(mesh)),
+    m_Boundary(boundary),
+    m_Depth(depth),
+    m_NumPoints(m_Mesh->NumPoints()),
+    m_NumTriangles(m_Mesh->NumTriangles())
+{
+    // the skirt faces outward if the boundary runs counter-clockwise
+    double area = 0;
+    for (int i = 0; i < m_Boundary.size(); i++) {
+        const glm::vec3 p = m_Mesh->Point(m_Boundary[i]);
+        const glm::vec3 q = m_Mesh->Point(
+            m_Boundary[(i + 1) % m_Boundary.size()]);
+        area += double(p.x) * q.y - double(q.x) * p.y;
+    }
+    if (area < 0) {
+        std::reverse(m_Boundary.begin(), m_Boundary.end());
+    }
+}
+
+glm::ivec3 SkirtMesh::Triangle(const int i) const {
+    if (i < m_NumTriangles) {
+        return m_Mesh->Triangle(i);
+    }
+    // triangles (a, a', b) and (b, a', b') for edge a-b, where a' and b'
+    // are the points below
+    const int n = m_Boundary.size();
+    const int j = (i - m_NumTriangles) / 2;
+    const int k = (j + 1) % n;
+    const int a = m_Boundary[j];
+    const int b = m_Boundary[k];
+    const int a1 = m_NumPoints + j;
+    const int b1 = m_NumPoints + k;
+    if ((i - m_NumTriangles) % 2 == 0) {
+        return glm::ivec3(a, a1, b);
+    }
+    return glm::ivec3(b, a1, b1);
+}
@@ -1,9 +1,51 @@
 #pragma once
 
 #include <glm/glm.hpp>
+#include <memory>
 #include <vector>
 
+#include "mesh.h"
+
+// adds walls and a floor below the mesh; boundary holds the indexes of the
+// points along the edges of the heightmap, in order around the mesh
 void AddBase(
     std::vector<glm::vec3> &points,
     std::vector<glm::ivec3> &triangles,
+    const std::vector<int> &boundary,
     const int w, const int h, const float z);
+
+// a mesh with a skirt hanging depth below its boundary, one quad per
+// boundary edge, to hide cracks between neighboring tiles; much lighter
+// than a solid base, and the mesh itself is not copied
+class SkirtMesh : public Mesh {
+public:
+    SkirtMesh(
+        std::unique_ptr<Mesh> mesh,
+        const std::vector<int> &boundary,
+        const float depth);
+
+    int NumPoints() const override {
+        return m_NumPoints + m_Boundary.size();
+    }
+
+    int NumTriangles() const override {
+        return m_NumTriangles + m_Boundary.size() * 2;
+    }
+
+    glm::vec3 Point(const int i) const override {
+        if (i < m_NumPoints) {
+            return m_Mesh->Point(i);
+        }
+        return m_Mesh->Point(m_Boundary[i - m_NumPoints]) -
+            glm::vec3(0, 0, m_Depth);
+    }
+
+    glm::ivec3 Triangle(const int i) const override;
+
+private:
+    std::unique_ptr<Mesh> m_Mesh;
+    std::vector<int> m_Boundary;
+    float m_Depth;
+    int m_NumPoints;
+    int m_NumTriangles;
+};
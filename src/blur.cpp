@@ -33,9 +33,9 @@ void BoxBlurH(
 {
     const float m = 1.f / (r + r + 1);
     for (int i = 0; i < h; i++) {
-        int ti = i * w;
-        int li = ti;
-        int ri = ti + r;
+        int64_t ti = int64_t(i) * w;
+        int64_t li = ti;
+        int64_t ri = ti + r;
         float fv = src[ti];
         float lv = src[ti + w - 1];
         float val = (r + 1) * fv;
@@ -71,14 +71,14 @@ void BoxBlurV(
 {
     const float m = 1.f / (r + r + 1);
     for (int i = 0; i < w; i++) {
-        int ti = i;
-        int li = ti;
-        int ri = ti + r * w;
+        int64_t ti = i;
+        int64_t li = ti;
+        int64_t ri = ti + int64_t(r) * w;
         float fv = src[ti];
-        float lv = src[ti + w * (h - 1)];
+        float lv = src[ti + int64_t(w) * (h - 1)];
         float val = (r + 1) * fv;
         for (int j = 0; j < r; j++) {
-            val += src[ti + j * w];
+            val += src[ti + int64_t(j) * w];
         }
         for (int j = 0; j <= r; j++) {
             val += src[ri] - fv;
@@ -0,0 +1,254 @@
+#include "glb.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+namespace {
+
+// per-vertex normals in mesh space, averaged from the normal map cells
+// around each vertex
+std::vector<glm::vec3> VertexNormals(
+    const Heightmap &heightmap, const Mesh &mesh, const float zScale)
+{
+    const int w = heightmap.Width() - 1;
+    const int h = heightmap.Height() - 1;
+    std::vector<glm::vec3> normals(mesh.NumPoints());
+    for (int i = 0; i < normals.size(); i++) {
+        const glm::vec3 p = mesh.Point(i);
+        const int x = std::round(p.x);
+        const int y = h - int(std::round(p.y));
+        glm::vec3 n(0);
+        for (int cy = std::max(y - 1, 0); cy <= std::min(y, h - 1); cy++) {
+            for (int cx = std::max(x - 1, 0); cx <= std::min(x, w - 1); cx++) {
+                n += heightmap.Normal(cx, cy, zScale);
+            }
+        }
+        // the normal map has y pointing down the image and z towards the
+        // viewer, so x is mirrored in mesh space
+        normals[i] = glm::normalize(glm::vec3(-n.x, n.y, n.z));
+    }
+    return normals;
+}
+
+// glTF is little-endian: values are appended least significant byte first,
+// whatever the byte order of the host
+void PutBytes(std::vector<char> &buf, const uint64_t bits, const int size) {
+    for (int i = 0; i < size; i++) {
+        buf.push_back(char(bits >> (i * 8)));
+    }
+}
+
+void Put(std::vector<char> &buf, const int8_t value) {
+    PutBytes(buf, uint8_t(value), 1);
+}
+
+void Put(std::vector<char> &buf, const uint16_t value) {
+    PutBytes(buf, value, 2);
+}
+
+void Put(std::vector<char> &buf, const uint32_t value) {
+    PutBytes(buf, value, 4);
+}
+
+void Put(std::vector<char> &buf, const float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, 4);
+    PutBytes(buf, bits, 4);
+}
+
+void Put(std::vector<char> &buf, const glm::vec3 &value) {
+    for (int i = 0; i < 3; i++) {
+        Put(buf, value[i]);
+    }
+}
+
+}
+
+void SaveGLB(
+    const std::string &path, const Mesh &mesh, const bool quantize,
+    const Heightmap *heightmap, const float zScale)
+{
+    const uint32_t numPoints = mesh.NumPoints();
+    const uint32_t numTriangles = mesh.NumTriangles();
+
+    // bounds
+    glm::vec3 lo(0);
+    glm::vec3 hi(0);
+    for (uint32_t i = 0; i < numPoints; i++) {
+        const glm::vec3 p = mesh.Point(i);
+        lo = i ? glm::min(lo, p) : p;
+        hi = i ? glm::max(hi, p) : p;
+    }
+
+    // quantized positions are offsets from lo in steps of scale, the same
+    // on every axis so that normals need no correction for it. The step is
+    // a power of two fraction of a pixel, which keeps x and y exact, unless
+    // the mesh is over 65535 units across
+    float scale = 1;
+    if (quantize) {
+        const glm::vec3 size = hi - lo;
+        const float extent = std::max(std::max(size.x, size.y), size.z);
+        if (extent > 65535) {
+            scale = extent / 65535;
+        } else if (extent > 0) {
+            while (extent / (scale / 2) <= 65535) {
+                scale /= 2;
+            }
+        }
+    }
+    const auto quantized = [&lo, scale](const glm::vec3 p) {
+        return glm::min(glm::round((p - lo) / scale), glm::vec3(65535));
+    };
+
+    std::vector<glm::vec3> normals;
+    if (heightmap) {
+        normals = VertexNormals(*heightmap, mesh, zScale);
+    }
+
+    // buffer layout: positions, normals, indices; vertex attributes are
+    // padded to 4 byte strides
+    const bool wide = numPoints > 65535;
+    const uint32_t positionStride = quantize ? 8 : 12;
+    const uint32_t normalStride = quantize ? 4 : 12;
+    const uint32_t indexSize = wide ? 4 : 2;
+    const uint32_t positionBytes = numPoints * positionStride;
+    const uint32_t normalBytes = normals.empty() ? 0 : numPoints * normalStride;
+    const uint32_t indexBytes = numTriangles * 3 * indexSize;
+    const uint32_t binBytes =
+        (positionBytes + normalBytes + indexBytes + 3) / 4 * 4;
+
+    // json
+    const glm::vec3 qlo = quantize ? glm::vec3(0) : lo;
+    const glm::vec3 qhi = quantize ? quantized(hi) : hi;
+    char buf[4096];
+    std::string json = "{\"asset\":{\"version\":\"2.0\",\"generator\":\"hmm\"}";
+    if (quantize) {
+        json += ",\"extensionsUsed\":[\"KHR_mesh_quantization\"]";
+        json += ",\"extensionsRequired\":[\"KHR_mesh_quantization\"]";
+    }
+    json += ",\"scene\":0,\"scenes\":[{\"nodes\":[0]}]";
+    // the parent node turns z up into y up, the child dequantizes
+    json += ",\"nodes\":[{\"rotation\":[-0.70710678,0,0,0.70710678],"
+        "\"children\":[1]},{\"mesh\":0";
+    if (quantize) {
+        snprintf(buf, sizeof(buf),
+            ",\"translation\":[%.9g,%.9g,%.9g],\"scale\":[%.9g,%.9g,%.9g]",
+            lo.x, lo.y, lo.z, scale, scale, scale);
+        json += buf;
+    }
+    json += "}]";
+    json += ",\"meshes\":[{\"primitives\":[{\"attributes\":{\"POSITION\":0";
+    if (!normals.empty()) {
+        json += ",\"NORMAL\":2";
+    }
+    json += "},\"indices\":1}]}]";
+    snprintf(buf, sizeof(buf),
+        ",\"accessors\":["
+        "{\"bufferView\":0,\"componentType\":%d,\"count\":%u,\"type\":\"VEC3\","
+        "\"min\":[%.9g,%.9g,%.9g],\"max\":[%.9g,%.9g,%.9g]},"
+        "{\"bufferView\":%d,\"componentType\":%d,\"count\":%u,\"type\":\"SCALAR\"}",
+        quantize ? 5123 : 5126, numPoints,
+        qlo.x, qlo.y, qlo.z, qhi.x, qhi.y, qhi.z,
+        normals.empty() ? 1 : 2, wide ? 5125 : 5123, numTriangles * 3);
+    json += buf;
+    if (!normals.empty()) {
+        snprintf(buf, sizeof(buf),
+            ",{\"bufferView\":1,\"componentType\":%d,%s\"count\":%u,"
+            "\"type\":\"VEC3\"}",
+            quantize ? 5120 : 5126,
+            quantize ? "\"normalized\":true," : "", numPoints);
+        json += buf;
+    }
+    json += "]";
+    snprintf(buf, sizeof(buf),
+        ",\"bufferViews\":["
+        "{\"buffer\":0,\"byteOffset\":0,\"byteLength\":%u,\"byteStride\":%u,"
+        "\"target\":34962}",
+        positionBytes, positionStride);
+    json += buf;
+    if (!normals.empty()) {
+        snprintf(buf, sizeof(buf),
+            ",{\"buffer\":0,\"byteOffset\":%u,\"byteLength\":%u,"
+            "\"byteStride\":%u,\"target\":34962}",
+            positionBytes, normalBytes, normalStride);
+        json += buf;
+    }
+    snprintf(buf, sizeof(buf),
+        ",{\"buffer\":0,\"byteOffset\":%u,\"byteLength\":%u,\"target\":34963}]"
+        ",\"buffers\":[{\"byteLength\":%u}]}",
+        positionBytes + normalBytes, indexBytes, binBytes);
+    json += buf;
+    while (json.size() % 4 != 0) {
+        json += ' ';
+    }
+
+    std::fstream file(path, std::ios::out | std::ios::binary);
+
+    // header and chunk headers
+    const uint32_t jsonBytes = json.size();
+    std::vector<char> data;
+    Put(data, uint32_t(0x46546C67));
+    Put(data, uint32_t(2));
+    Put(data, 12 + 8 + jsonBytes + 8 + binBytes);
+    Put(data, jsonBytes);
+    Put(data, uint32_t(0x4E4F534A));
+    data.insert(data.end(), json.begin(), json.end());
+    Put(data, binBytes);
+    Put(data, uint32_t(0x004E4942));
+
+    // binary data, written in chunks
+    const auto flush = [&data, &file](const bool force) {
+        if (force || data.size() >= (1 << 20)) {
+            file.write(data.data(), data.size());
+            data.clear();
+        }
+    };
+
+    for (uint32_t i = 0; i < numPoints; i++) {
+        const glm::vec3 p = mesh.Point(i);
+        if (quantize) {
+            const glm::vec3 q = quantized(p);
+            Put(data, uint16_t(q.x));
+            Put(data, uint16_t(q.y));
+            Put(data, uint16_t(q.z));
+            Put(data, uint16_t(0));
+        } else {
+            Put(data, p);
+        }
+        flush(false);
+    }
+
+    for (const glm::vec3 &n : normals) {
+        if (quantize) {
+            const glm::vec3 m = n * 127.f;
+            Put(data, int8_t(std::round(m.x)));
+            Put(data, int8_t(std::round(m.y)));
+            Put(data, int8_t(std::round(m.z)));
+            Put(data, int8_t(0));
+        } else {
+            Put(data, n);
+        }
+        flush(false);
+    }
+
+    for (uint32_t i = 0; i < numTriangles; i++) {
+        const glm::ivec3 t = mesh.Triangle(i);
+        for (int j = 0; j < 3; j++) {
+            if (wide) {
+                Put(data, uint32_t(t[j]));
+            } else {
+                Put(data, uint16_t(t[j]));
+            }
+        }
+        flush(false);
+    }
+
+    data.resize(data.size() + binBytes -
+        (positionBytes + normalBytes + indexBytes), 0);
+    flush(true);
+    file.close();
+}
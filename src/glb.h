@@ -0,0 +1,15 @@
+#pragma once
+
+#include <string>
+
+#include "heightmap.h"
+#include "mesh.h"
+
+// writes a mesh as binary glTF (GLB), indexed with 16 or 32 bit indices
+// depending on the vertex count. The mesh is rotated from z up to glTF's
+// y up. With quantize, positions are stored as 16 bit integers and normals
+// as 8 bit (KHR_mesh_quantization). If a heightmap is given, per-vertex
+// normals are sampled from its normal map, scaled by zScale
+void SaveGLB(
+    const std::string &path, const Mesh &mesh, const bool quantize,
+    const Heightmap *heightmap, const float zScale);
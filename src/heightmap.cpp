@@ -1,21 +1,101 @@
 #include "heightmap.h"
 
 #define GLM_ENABLE_EXPERIMENTAL
-#include <glm/gtx/normal.hpp>
+#include <glm/gtc/constants.hpp>
 #include <glm/gtx/polar_coordinates.hpp>
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <thread>
 
 #include "blur.h"
+#include "png.h"
+#include "tiles.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#include "stb_image_write.h"
+namespace {
+
+// reads a binary (P5) pgm file with 8 or 16 bit samples; stb_image
+// rejects images over 2^31 bytes, so this is the way in for larger inputs
+bool LoadPGM(
+    const std::string &path, int &width, int &height,
+    std::vector<float> &data)
+{
+    FILE *f = fopen(path.c_str(), "rb");
+    if (!f) {
+        return false;
+    }
+    // header fields, skipping whitespace and # comments
+    const auto field = [f]() {
+        int c = fgetc(f);
+        while (c == '#' || isspace(c)) {
+            if (c == '#') {
+                while (c != '\n' && c != EOF) {
+                    c = fgetc(f);
+                }
+            }
+            c = fgetc(f);
+        }
+        int value = -1;
+        while (isdigit(c)) {
+            value = std::max(value, 0) * 10 + (c - '0');
+            c = fgetc(f);
+        }
+        return isspace(c) ? value : -1;
+    };
+    if (fgetc(f) != 'P' || fgetc(f) != '5') {
+        fclose(f);
+        return false;
+    }
+    const int w = field();
+    const int h = field();
+    const int maxval = field();
+    if (w <= 0 || h <= 0 || maxval <= 0 || maxval > 65535) {
+        fclose(f);
+        return false;
+    }
+    const size_t n = size_t(w) * h;
+    data.resize(n);
+    const size_t bytes = maxval > 255 ? 2 : 1;
+    // 8 bit samples are widened to 16 bits and scaled as stb_image does,
+    // ignoring maxval, so that results don't depend on which loader read
+    // the file; stb_image can't read 16 bit pgm files
+    const float m = bytes == 2 ? 1.f / maxval : 1.f / 65535.f;
+    std::vector<uint8_t> row(size_t(w) * bytes);
+    size_t i = 0;
+    for (int y = 0; y < h; y++) {
+        if (fread(row.data(), 1, row.size(), f) != row.size()) {
+            fclose(f);
+            data.clear();
+            return false;
+        }
+        for (int x = 0; x < w; x++) {
+            // 16 bit samples are big endian
+            const int v = bytes == 2 ?
+                (row[x * 2] << 8) | row[x * 2 + 1] : row[x] * 257;
+            data[i++] = v * m;
+        }
+    }
+    fclose(f);
+    width = w;
+    height = h;
+    return true;
+}
+
+}
 
 Heightmap::Heightmap(const std::string &path) :
     m_Width(0),
     m_Height(0)
 {
+    if (LoadPGM(path, m_Width, m_Height, m_Data)) {
+        return;
+    }
+
     int w, h, c;
     uint16_t *data = stbi_load_16(path.c_str(), &w, &h, &c, 1);
     if (!data) {
@@ -23,10 +103,10 @@ Heightmap::Heightmap(const std::string &path) :
     }
     m_Width = w;
     m_Height = h;
-    const int n = w * h;
+    const size_t n = size_t(w) * h;
     const float m = 1.f / 65535.f;
     m_Data.resize(n);
-    for (int i = 0; i < n; i++) {
+    for (size_t i = 0; i < n; i++) {
         m_Data[i] = data[i] * m;
     }
     free(data);
@@ -44,26 +124,26 @@ Heightmap::Heightmap(
 void Heightmap::AutoLevel() {
     float lo = m_Data[0];
     float hi = m_Data[0];
-    for (int i = 0; i < m_Data.size(); i++) {
+    for (size_t i = 0; i < m_Data.size(); i++) {
         lo = std::min(lo, m_Data[i]);
         hi = std::max(hi, m_Data[i]);
     }
     if (hi == lo) {
         return;
     }
-    for (int i = 0; i < m_Data.size(); i++) {
+    for (size_t i = 0; i < m_Data.size(); i++) {
         m_Data[i] = (m_Data[i] - lo) / (hi - lo);
     }
 }
 
 void Heightmap::Invert() {
-    for (int i = 0; i < m_Data.size(); i++) {
+    for (size_t i = 0; i < m_Data.size(); i++) {
         m_Data[i] = 1.f - m_Data[i];
     }
 }
 
 void Heightmap::GammaCurve(const float gamma) {
-    for (int i = 0; i < m_Data.size(); i++) {
+    for (size_t i = 0; i < m_Data.size(); i++) {
         m_Data[i] = std::pow(m_Data[i], gamma);
     }
 }
@@ -71,10 +151,10 @@ void Heightmap::GammaCurve(const float gamma) {
 void Heightmap::AddBorder(const int size, const float z) {
     const int w = m_Width + size * 2;
     const int h = m_Height + size * 2;
-    std::vector<float> data(w * h, z);
-    int i = 0;
+    std::vector<float> data(size_t(w) * h, z);
+    size_t i = 0;
     for (int y = 0; y < m_Height; y++) {
-        int j = (y + size) * w + size;
+        size_t j = size_t(y + size) * w + size;
         for (int x = 0; x < m_Width; x++) {
             data[j++] = m_Data[i++];
         }
@@ -84,39 +164,127 @@ void Heightmap::AddBorder(const int size, const float z) {
     m_Data = data;
 }
 
+void Heightmap::Paste(const Heightmap &other, const int x0, const int y0) {
+    for (int y = std::max(y0, 0); y < std::min(y0 + other.m_Height, m_Height); y++) {
+        for (int x = std::max(x0, 0); x < std::min(x0 + other.m_Width, m_Width); x++) {
+            m_Data[int64_t(y) * m_Width + x] = other.At(x - x0, y - y0);
+        }
+    }
+}
+
 void Heightmap::GaussianBlur(const int r) {
     m_Data = ::GaussianBlur(m_Data, m_Width, m_Height, r);
 }
 
-std::vector<glm::vec3> Heightmap::Normalmap(const float zScale) const {
+Heightmap Heightmap::Downsample() const {
+    const int w = (m_Width + 1) / 2;
+    const int h = (m_Height + 1) / 2;
+    std::vector<float> data(size_t(w) * h);
+    size_t i = 0;
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            data[i++] = At(x * 2, y * 2);
+        }
+    }
+    return Heightmap(w, h, data);
+}
+
+namespace {
+
+// normal of a normal map cell from its corner heights (already scaled by
+// -zScale): the normalized sum of the unit normals of the four triangles
+// fanning around the cell center, in closed form
+inline void CellNormal(
+    const float z00, const float z10, const float z01, const float z11,
+    float &nx, float &ny, float &nz)
+{
+    const float zc = (z00 + z01 + z10 + z11) / 4.f;
+    const float a = zc - z00;
+    const float b = zc - z10;
+    const float c = zc - z11;
+    const float d = zc - z01;
+    // triangle normals, scaled to a z of 1
+    const float x0 = b - a;
+    const float y0 = -(a + b);
+    const float x1 = b + c;
+    const float y1 = c - b;
+    const float x2 = c - d;
+    const float y2 = c + d;
+    const float x3 = -(a + d);
+    const float y3 = d - a;
+    const float l0 = 1.f / std::sqrt(x0 * x0 + y0 * y0 + 1.f);
+    const float l1 = 1.f / std::sqrt(x1 * x1 + y1 * y1 + 1.f);
+    const float l2 = 1.f / std::sqrt(x2 * x2 + y2 * y2 + 1.f);
+    const float l3 = 1.f / std::sqrt(x3 * x3 + y3 * y3 + 1.f);
+    const float sx = x0 * l0 + x1 * l1 + x2 * l2 + x3 * l3;
+    const float sy = y0 * l0 + y1 * l1 + y2 * l2 + y3 * l3;
+    const float sz = l0 + l1 + l2 + l3;
+    const float l = 1.f / std::sqrt(sx * sx + sy * sy + sz * sz);
+    nx = sx * l;
+    ny = sy * l;
+    nz = sz * l;
+}
+
+// calls fn(y0, y1) for bands of rows [y0, y1) on the given number of
+// threads, or on all cores for 0
+void ParallelRows(
+    const int h, int numThreads, const std::function<void(int, int)> &fn)
+{
+    if (numThreads <= 0) {
+        numThreads = std::thread::hardware_concurrency();
+    }
+    const int n = std::max(1, std::min(numThreads, h / 16));
+    std::vector<std::thread> threads;
+    for (int i = 0; i < n; i++) {
+        threads.emplace_back(fn, int64_t(h) * i / n, int64_t(h) * (i + 1) / n);
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+}
+
+}
+
+glm::vec3 Heightmap::Normal(const int x, const int y, const float zScale) const {
+    glm::vec3 n;
+    CellNormal(
+        At(x, y) * -zScale, At(x + 1, y) * -zScale,
+        At(x, y + 1) * -zScale, At(x + 1, y + 1) * -zScale,
+        n.x, n.y, n.z);
+    return n;
+}
+
+void Heightmap::NormalRow(
+    const int y, const float zScale,
+    float *nx, float *ny, float *nz) const
+{
+    const float *row0 = &m_Data[int64_t(y) * m_Width];
+    const float *row1 = row0 + m_Width;
+    const int w = m_Width - 1;
+    for (int x = 0; x < w; x++) {
+        CellNormal(
+            row0[x] * -zScale, row0[x + 1] * -zScale,
+            row1[x] * -zScale, row1[x + 1] * -zScale,
+            nx[x], ny[x], nz[x]);
+    }
+}
+
+std::vector<glm::vec3> Heightmap::Normalmap(
+    const float zScale, const int numThreads) const
+{
     const int w = m_Width - 1;
     const int h = m_Height - 1;
-    std::vector<glm::vec3> result(w * h);
-    int i = 0;
-    for (int y0 = 0; y0 < h; y0++) {
-        const int y1 = y0 + 1;
-        const float yc = y0 + 0.5f;
-        for (int x0 = 0; x0 < w; x0++) {
-            const int x1 = x0 + 1;
-            const float xc = x0 + 0.5f;
-            const float z00 = At(x0, y0) * -zScale;
-            const float z01 = At(x0, y1) * -zScale;
-            const float z10 = At(x1, y0) * -zScale;
-            const float z11 = At(x1, y1) * -zScale;
-            const float zc = (z00 + z01 + z10 + z11) / 4.f;
-            const glm::vec3 p00(x0, y0, z00);
-            const glm::vec3 p01(x0, y1, z01);
-            const glm::vec3 p10(x1, y0, z10);
-            const glm::vec3 p11(x1, y1, z11);
-            const glm::vec3 pc(xc, yc, zc);
-            const glm::vec3 n0 = glm::triangleNormal(pc, p00, p10);
-            const glm::vec3 n1 = glm::triangleNormal(pc, p10, p11);
-            const glm::vec3 n2 = glm::triangleNormal(pc, p11, p01);
-            const glm::vec3 n3 = glm::triangleNormal(pc, p01, p00);
-            result[i] = glm::normalize(n0 + n1 + n2 + n3);
-            i++;
+    std::vector<glm::vec3> result(size_t(w) * h);
+    ParallelRows(h, numThreads, [&](const int y0, const int y1) {
+        std::vector<float> nx(w), ny(w), nz(w);
+        for (int y = y0; y < y1; y++) {
+            NormalRow(y, zScale, nx.data(), ny.data(), nz.data());
+            glm::vec3 *row = &result[size_t(y) * w];
+            for (int x = 0; x < w; x++) {
+                row[x] = glm::vec3(nx[x], ny[x], nz[x]);
+            }
         }
-    }
+    });
     return result;
 }
 
@@ -124,18 +292,7 @@ void Heightmap::SaveNormalmap(
     const std::string &path,
     const float zScale) const
 {
-    const std::vector<glm::vec3> nm = Normalmap(zScale);
-    std::vector<uint8_t> data(nm.size() * 3);
-    int i = 0;
-    for (glm::vec3 n : nm) {
-        n = (n + 1.f) / 2.f;
-        data[i++] = uint8_t(n.x * 255);
-        data[i++] = uint8_t(n.y * 255);
-        data[i++] = uint8_t(n.z * 255);
-    }
-    stbi_write_png(
-        path.c_str(), m_Width - 1, m_Height - 1, 3,
-        data.data(), (m_Width - 1) * 3);
+    SaveImages(zScale, path, {}, "");
 }
 
 void Heightmap::SaveHillshade(
@@ -144,47 +301,231 @@ void Heightmap::SaveHillshade(
     const float altitude,
     const float azimuth) const
 {
-    const glm::vec3 light = glm::euclidean(glm::vec2(
-        glm::radians(altitude), glm::radians(-azimuth))).xzy();
-    const std::vector<glm::vec3> nm = Normalmap(zScale);
-    std::vector<uint8_t> data(nm.size() * 3);
-    int i = 0;
-    for (glm::vec3 n : nm) {
-        const uint8_t d = glm::clamp(glm::dot(n, light), 0.f, 1.f) * 255;
-        data[i++] = d;
-        data[i++] = d;
-        data[i++] = d;
-    }
-    stbi_write_png(
-        path.c_str(), m_Width - 1, m_Height - 1, 3,
-        data.data(), (m_Width - 1) * 3);
+    SaveImages(zScale, "", {{path, altitude, azimuth}}, "");
+}
+
+void Heightmap::SaveImages(
+    const float zScale,
+    const std::string &normalmapPath,
+    const std::vector<Hillshade> &hillshades,
+    const std::string &slopePath,
+    const int tileSize,
+    const int numThreads) const
+{
+    const int w = m_Width - 1;
+    const int h = m_Height - 1;
+
+    // every image is 8-bit RGB, rendered a row at a time from the normals
+    using Render = std::function<void(
+        const float *nx, const float *ny, const float *nz, uint8_t *row)>;
+    std::vector<std::pair<std::string, Render>> images;
+    if (!normalmapPath.empty()) {
+        images.emplace_back(normalmapPath, [w](
+            const float *nx, const float *ny, const float *nz, uint8_t *row)
+        {
+            for (int x = 0; x < w; x++) {
+                row[x * 3 + 0] = uint8_t((nx[x] + 1.f) / 2.f * 255);
+                row[x * 3 + 1] = uint8_t((ny[x] + 1.f) / 2.f * 255);
+                row[x * 3 + 2] = uint8_t((nz[x] + 1.f) / 2.f * 255);
+            }
+        });
+    }
+    for (const Hillshade &hillshade : hillshades) {
+        const glm::vec3 light = glm::euclidean(glm::vec2(
+            glm::radians(hillshade.altitude),
+            glm::radians(-hillshade.azimuth))).xzy();
+        images.emplace_back(hillshade.path, [w, light](
+            const float *nx, const float *ny, const float *nz, uint8_t *row)
+        {
+            for (int x = 0; x < w; x++) {
+                const float dot =
+                    nx[x] * light.x + ny[x] * light.y + nz[x] * light.z;
+                const uint8_t d = glm::clamp(dot, 0.f, 1.f) * 255;
+                row[x * 3 + 0] = d;
+                row[x * 3 + 1] = d;
+                row[x * 3 + 2] = d;
+            }
+        });
+    }
+    // slope runs from black when flat to white when vertical
+    if (!slopePath.empty()) {
+        images.emplace_back(slopePath, [w](
+            const float *, const float *, const float *nz, uint8_t *row)
+        {
+            for (int x = 0; x < w; x++) {
+                const float angle = std::acos(glm::clamp(nz[x], 0.f, 1.f));
+                const uint8_t d = angle / glm::half_pi<float>() * 255;
+                row[x * 3 + 0] = d;
+                row[x * 3 + 1] = d;
+                row[x * 3 + 2] = d;
+            }
+        });
+    }
+
+    // each normal is computed once and rendered into all of the images, a
+    // band of rows per thread; tiled images only hold one band of rows
+    const int bandRows = tileSize > 0 ? tileSize : h;
+    std::vector<std::vector<uint8_t>> bands(images.size());
+    std::vector<std::unique_ptr<TilePyramid>> pyramids;
+    for (int i = 0; i < images.size(); i++) {
+        bands[i].resize(size_t(w) * std::min(bandRows, h) * 3);
+        if (tileSize > 0) {
+            pyramids.emplace_back(new TilePyramid(
+                images[i].first, w, h, 3, tileSize, numThreads));
+        }
+    }
+    for (int y0 = 0; y0 < h; y0 += bandRows) {
+        const int rows = std::min(bandRows, h - y0);
+        ParallelRows(rows, numThreads, [&](const int r0, const int r1) {
+            std::vector<float> nx(w), ny(w), nz(w);
+            for (int r = r0; r < r1; r++) {
+                NormalRow(y0 + r, zScale, nx.data(), ny.data(), nz.data());
+                for (int i = 0; i < images.size(); i++) {
+                    images[i].second(
+                        nx.data(), ny.data(), nz.data(),
+                        &bands[i][size_t(r) * w * 3]);
+                }
+            }
+        });
+        for (int i = 0; i < images.size(); i++) {
+            if (tileSize > 0) {
+                pyramids[i]->AddRows(bands[i].data(), rows);
+            } else {
+                SavePNG(
+                    images[i].first, w, h, 3, bands[i].data(), numThreads);
+            }
+        }
+    }
+}
+
+std::vector<glm::ivec2> Heightmap::SimplifyLine(
+    const glm::ivec2 p0,
+    const glm::ivec2 p1,
+    const float maxError,
+    const Heightmap *weights) const
+{
+    // greedy 1D simplification of the profile along a line: segments are
+    // split at their worst pixel until every pixel is within maxError of
+    // the piecewise linear approximation
+    const glm::ivec2 d = p1 - p0;
+    const int n = std::max(std::abs(d.x), std::abs(d.y));
+    if (n == 0) {
+        return std::vector<glm::ivec2>{p0};
+    }
+
+    // i-th pixel along the line, stepping one pixel along the major axis
+    const auto point = [p0, d, n](const int i) {
+        return p0 + glm::ivec2(
+            std::lround(double(d.x) * i / n),
+            std::lround(double(d.y) * i / n));
+    };
+
+    std::vector<bool> keep(n + 1, false);
+    keep[0] = true;
+    keep[n] = true;
+
+    std::vector<std::pair<int, int>> stack;
+    stack.emplace_back(0, n);
+    while (!stack.empty()) {
+        const int i0 = stack.back().first;
+        const int i1 = stack.back().second;
+        stack.pop_back();
+
+        const float z0 = At(point(i0));
+        const float z1 = At(point(i1));
+        const float dz = (z1 - z0) / (i1 - i0);
+
+        float maxDz = 0;
+        int maxIndex = -1;
+        for (int i = i0 + 1; i < i1; i++) {
+            const float z = z0 + dz * (i - i0);
+            const glm::ivec2 p = point(i);
+            const float w = weights ? weights->At(p) : 1.f;
+            const float e = std::abs(z - At(p)) * w;
+            if (e > maxDz) {
+                maxDz = e;
+                maxIndex = i;
+            }
+        }
+
+        if (maxDz > maxError) {
+            keep[maxIndex] = true;
+            stack.emplace_back(maxIndex, i1);
+            stack.emplace_back(i0, maxIndex);
+        }
+    }
+
+    std::vector<glm::ivec2> result;
+    for (int i = 0; i <= n; i++) {
+        if (keep[i]) {
+            result.push_back(point(i));
+        }
+    }
+    return result;
+}
+
+std::pair<glm::ivec2, float> Heightmap::FindCandidate(
+    const glm::ivec2 p0,
+    const glm::ivec2 p1,
+    const glm::ivec2 p2,
+    const Heightmap *weights) const
+{
+    return FindCandidate(
+        p0, p1, p2, weights,
+        glm::ivec2(0), glm::ivec2(m_Width - 1, m_Height - 1));
 }
 
 std::pair<glm::ivec2, float> Heightmap::FindCandidate(
     const glm::ivec2 p0,
     const glm::ivec2 p1,
-    const glm::ivec2 p2) const
+    const glm::ivec2 p2,
+    const Heightmap *weights,
+    const glm::ivec2 lo,
+    const glm::ivec2 hi) const
+{
+    if (weights) {
+        return ScanTriangle(p0, p1, p2, lo, hi, [weights](const int x, const int y) {
+            return weights->At(x, y);
+        });
+    }
+    return ScanTriangle(p0, p1, p2, lo, hi, [](const int, const int) {
+        return 1.f;
+    });
+}
+
+template <typename W>
+std::pair<glm::ivec2, float> Heightmap::ScanTriangle(
+    const glm::ivec2 p0,
+    const glm::ivec2 p1,
+    const glm::ivec2 p2,
+    const glm::ivec2 lo,
+    const glm::ivec2 hi,
+    const W &weight) const
 {
     const auto edge = [](
         const glm::ivec2 a, const glm::ivec2 b, const glm::ivec2 c)
     {
-        return (b.x - c.x) * (a.y - c.y) - (b.y - c.y) * (a.x - c.x);
+        return int64_t(b.x - c.x) * (a.y - c.y) -
+            int64_t(b.y - c.y) * (a.x - c.x);
     };
 
-    // triangle bounding box
+    // triangle bounding box, clipped to the rows and columns to scan
     const glm::ivec2 min = glm::min(glm::min(p0, p1), p2);
     const glm::ivec2 max = glm::max(glm::max(p0, p1), p2);
+    const glm::ivec2 start(min.x, std::max(min.y, lo.y));
+    const int x1 = std::min(max.x, hi.x);
+    const int y1 = std::min(max.y, hi.y);
 
     // forward differencing variables
-    int w00 = edge(p1, p2, min);
-    int w01 = edge(p2, p0, min);
-    int w02 = edge(p0, p1, min);
-    const int a01 = p1.y - p0.y;
-    const int b01 = p0.x - p1.x;
-    const int a12 = p2.y - p1.y;
-    const int b12 = p1.x - p2.x;
-    const int a20 = p0.y - p2.y;
-    const int b20 = p2.x - p0.x;
+    int64_t w00 = edge(p1, p2, start);
+    int64_t w01 = edge(p2, p0, start);
+    int64_t w02 = edge(p0, p1, start);
+    const int64_t a01 = p1.y - p0.y;
+    const int64_t b01 = p0.x - p1.x;
+    const int64_t a12 = p2.y - p1.y;
+    const int64_t b12 = p1.x - p2.x;
+    const int64_t a20 = p0.y - p2.y;
+    const int64_t b20 = p2.x - p0.x;
 
     // pre-multiplied z values at vertices
     const float a = edge(p0, p1, p2);
@@ -195,9 +536,9 @@ std::pair<glm::ivec2, float> Heightmap::FindCandidate(
     // iterate over pixels in bounding box
     float maxError = 0;
     glm::ivec2 maxPoint(0);
-    for (int y = min.y; y <= max.y; y++) {
+    for (int y = start.y; y <= y1; y++) {
         // compute starting offset
-        int dx = 0;
+        int64_t dx = std::max(0, lo.x - min.x);
         if (w00 < 0 && a12 != 0) {
             dx = std::max(dx, -w00 / a12);
         }
@@ -208,20 +549,20 @@ std::pair<glm::ivec2, float> Heightmap::FindCandidate(
             dx = std::max(dx, -w02 / a01);
         }
 
-        int w0 = w00 + a12 * dx;
-        int w1 = w01 + a20 * dx;
-        int w2 = w02 + a01 * dx;
+        int64_t w0 = w00 + a12 * dx;
+        int64_t w1 = w01 + a20 * dx;
+        int64_t w2 = w02 + a01 * dx;
 
         bool wasInside = false;
 
-        for (int x = min.x + dx; x <= max.x; x++) {
+        for (int x = min.x + dx; x <= x1; x++) {
             // check if inside triangle
             if (w0 >= 0 && w1 >= 0 && w2 >= 0) {
                 wasInside = true;
 
                 // compute z using barycentric coordinates
                 const float z = z0 * w0 + z1 * w1 + z2 * w2;
-                const float dz = std::abs(z - At(x, y));
+                const float dz = std::abs(z - At(x, y)) * weight(x, y);
                 if (dz > maxError) {
                     maxError = dz;
                     maxPoint = glm::ivec2(x, y);
@@ -6,6 +6,13 @@
 #include <utility>
 #include <vector>
 
+// a hillshade image to write, with its light direction in degrees
+struct Hillshade {
+    std::string path;
+    float altitude;
+    float azimuth;
+};
+
 class Heightmap {
 public:
     Heightmap(const std::string &path);
@@ -24,11 +31,11 @@ public:
     }
 
     float At(const int x, const int y) const {
-        return m_Data[y * m_Width + x];
+        return m_Data[int64_t(y) * m_Width + x];
     }
 
     float At(const glm::ivec2 p) const {
-        return m_Data[p.y * m_Width + p.x];
+        return m_Data[int64_t(p.y) * m_Width + p.x];
     }
 
     void AutoLevel();
@@ -39,9 +46,23 @@ public:
 
     void AddBorder(const int size, const float z);
 
+    // copies the other heightmap into this one with its top left corner
+    // at (x0, y0), clipped to the bounds
+    void Paste(const Heightmap &other, const int x0, const int y0);
+
     void GaussianBlur(const int r);
 
-    std::vector<glm::vec3> Normalmap(const float zScale) const;
+    // returns every other pixel in each direction, so that pixel (x, y)
+    // of the result is pixel (2x, 2y) of the original
+    Heightmap Downsample() const;
+
+    // normal map cells lie between pixels, so the map is one pixel smaller
+    // than the heightmap in each direction; Normal gives a single cell
+    glm::vec3 Normal(const int x, const int y, const float zScale) const;
+
+    // the thread counts of these take 0 for all cores
+    std::vector<glm::vec3> Normalmap(
+        const float zScale, const int numThreads = 0) const;
 
     void SaveNormalmap(const std::string &path, const float zScale) const;
 
@@ -49,12 +70,55 @@ public:
         const std::string &path, const float zScale,
         const float altitude, const float azimuth) const;
 
+    // writes any of a normal map, hillshades and a slope image in a single
+    // sweep, computing each normal once; empty paths are skipped, and with a
+    // tile size the paths are directories of xyz tile pyramids
+    void SaveImages(
+        const float zScale,
+        const std::string &normalmapPath,
+        const std::vector<Hillshade> &hillshades,
+        const std::string &slopePath,
+        const int tileSize = 0,
+        const int numThreads = 0) const;
+
+    // errors are scaled by the optional per-pixel weights
+    std::vector<glm::ivec2> SimplifyLine(
+        const glm::ivec2 p0,
+        const glm::ivec2 p1,
+        const float maxError,
+        const Heightmap *weights) const;
+
     std::pair<glm::ivec2, float> FindCandidate(
         const glm::ivec2 p0,
         const glm::ivec2 p1,
-        const glm::ivec2 p2) const;
+        const glm::ivec2 p2,
+        const Heightmap *weights) const;
+
+    // only considers the pixels of the triangle within the (inclusive)
+    // rectangle lo..hi
+    std::pair<glm::ivec2, float> FindCandidate(
+        const glm::ivec2 p0,
+        const glm::ivec2 p1,
+        const glm::ivec2 p2,
+        const Heightmap *weights,
+        const glm::ivec2 lo,
+        const glm::ivec2 hi) const;
 
 private:
+    template <typename W>
+    std::pair<glm::ivec2, float> ScanTriangle(
+        const glm::ivec2 p0,
+        const glm::ivec2 p1,
+        const glm::ivec2 p2,
+        const glm::ivec2 lo,
+        const glm::ivec2 hi,
+        const W &weight) const;
+
+    // normals of the normal map cells between rows y and y + 1
+    void NormalRow(
+        const int y, const float zScale,
+        float *nx, float *ny, float *nz) const;
+
     int m_Width;
     int m_Height;
     std::vector<float> m_Data;
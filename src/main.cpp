@@ -1,12 +1,22 @@
+#include <cctype>
 #include <chrono>
+#include <cstdlib>
+#include <cstring>
 #include <functional>
 #include <iostream>
+#include <memory>
 #include <string>
+#include <vector>
 
 #include "base.h"
 #include "cmdline.h"
+#include "glb.h"
 #include "heightmap.h"
+#include "order.h"
+#include "rtin.h"
+#include "seeds.h"
 #include "stl.h"
+#include "terrain.h"
 #include "triangulator.h"
 
 int main(int argc, char **argv) {
@@ -22,7 +32,24 @@ int main(int argc, char **argv) {
     p.add<float>("error", 'e', "maximum triangulation error", false, 0.001);
     p.add<int>("triangles", 't', "maximum number of triangles", false, 0);
     p.add<int>("points", 'p', "maximum number of vertices", false, 0);
+    p.add<float>("time-limit", '\0', "stop refining after this many seconds", false, 0);
+    p.add<float>("max-memory", '\0', "limit triangles to fit this many megabytes", false, 0);
     p.add<float>("base", 'b', "solid base height", false, 0);
+    p.add<float>("skirt", '\0', "skirt depth below the edges, instead of a base", false, 0);
+    p.add<std::string>("order", '\0', "output triangle order (storage, cache, hilbert)", false, "storage",
+        cmdline::oneof<std::string>("storage", "cache", "hilbert"));
+    p.add("quantize", '\0', "store glb positions and normals as integers");
+    p.add("normals", '\0', "add per-vertex normals to glb output");
+    p.add<int>("threads", 'j', "threads (0 = all cores)", false, 1);
+    p.add("lock-edges", '\0', "simplify edges independently so adjacent tiles join");
+    p.add<std::string>("seeds", '\0', "path to fixed points and breaklines", false, "");
+    p.add<std::string>("weights", '\0', "path to per-pixel error weight image", false, "");
+    p.add("lazy", '\0', "rasterize triangles only when needed");
+    p.add<int>("coarse", '\0', "coarse to fine levels, each at half resolution", false, 0);
+    p.add<int>("frames", '\0', "number of frames, file names are printf patterns", false, 0);
+    p.add<int>("first-frame", '\0', "number of the first frame", false, 0);
+    p.add("flip", '\0', "flip edges that lower the error (slower, fewer triangles)");
+    p.add("rtin", '\0', "use a right-triangulated irregular network (2^k+1 size)");
     p.add("level", '\0', "auto level input to full grayscale range");
     p.add("invert", '\0', "invert heightmap");
     p.add<int>("blur", '\0', "gaussian blur sigma", false, 0);
@@ -33,8 +60,13 @@ int main(int argc, char **argv) {
     p.add<std::string>("shade-path", '\0', "path to write hillshade png", false, "");
     p.add<float>("shade-alt", '\0', "hillshade light altitude", false, 45);
     p.add<float>("shade-az", '\0', "hillshade light azimuth", false, 0);
+    p.add<std::string>("shade-lights", '\0', "more hillshades, as alt:az:path,...", false, "");
+    p.add<std::string>("slope-path", '\0', "path to write slope png", false, "");
+    p.add<int>("tile-size", '\0', "write images as z/x/y png tiles of this size", false, 0,
+        cmdline::oneof<int>(0, 256, 512));
+    p.add<int>("image-threads", '\0', "threads for images (0 = all cores)", false, 0);
     p.add("quiet", 'q', "suppress console output");
-    p.footer("infile outfile.stl");
+    p.footer("infile outfile.stl|outfile.terrain|outfile.glb");
     p.parse_check(argc, argv);
 
     // infile required
@@ -50,7 +82,24 @@ int main(int argc, char **argv) {
     const float maxError = p.get<float>("error");
     const int maxTriangles = p.get<int>("triangles");
     const int maxPoints = p.get<int>("points");
+    const float timeLimit = p.get<float>("time-limit");
+    const float maxMemory = p.get<float>("max-memory");
     const float baseHeight = p.get<float>("base");
+    const float skirtDepth = p.get<float>("skirt");
+    const std::string order = p.get<std::string>("order");
+    const bool quantize = p.exist("quantize");
+    const bool vertexNormals = p.exist("normals");
+    const int numThreads = p.get<int>("threads");
+    const int imageThreads = p.get<int>("image-threads");
+    const bool lockEdges = p.exist("lock-edges");
+    const std::string seedsPath = p.get<std::string>("seeds");
+    const std::string weightsPath = p.get<std::string>("weights");
+    const bool lazy = p.exist("lazy");
+    const int coarseLevels = p.get<int>("coarse");
+    const int numFrames = p.get<int>("frames");
+    const int firstFrame = p.get<int>("first-frame");
+    const bool flip = p.exist("flip");
+    const bool rtin = p.exist("rtin");
     const bool level = p.exist("level");
     const bool invert = p.exist("invert");
     const int blurSigma = p.get<int>("blur");
@@ -61,10 +110,94 @@ int main(int argc, char **argv) {
     const std::string shadePath = p.get<std::string>("shade-path");
     const float shadeAlt = p.get<float>("shade-alt");
     const float shadeAz = p.get<float>("shade-az");
+    const std::string shadeLights = p.get<std::string>("shade-lights");
+    const std::string slopePath = p.get<std::string>("slope-path");
+    const int tileSize = p.get<int>("tile-size");
     const bool quiet = p.exist("quiet");
 
     const bool hasOutFile = p.rest().size() > 1;
-    const bool hasOtherFile = !normalmapPath.empty() || !shadePath.empty();
+    const std::string outPattern = hasOutFile ? p.rest()[1] : "";
+    // the output format follows the file extension, defaulting to stl
+    const auto hasExtension = [&outPattern](const std::string &ext) {
+        return outPattern.size() >= ext.size() &&
+            outPattern.compare(outPattern.size() - ext.size(), ext.size(), ext) == 0;
+    };
+    const bool quantized = hasExtension(".terrain");
+    const bool glb = hasExtension(".glb");
+    if ((quantize || vertexNormals) && !glb) {
+        std::cerr
+            << "--quantize and --normals need a .glb outfile" << std::endl
+            << p.usage();
+        std::exit(1);
+    }
+    if (baseHeight > 0 && skirtDepth > 0) {
+        std::cerr
+            << "--skirt cannot be used with a base" << std::endl
+            << p.usage();
+        std::exit(1);
+    }
+    if (vertexNormals && (baseHeight > 0 || skirtDepth > 0)) {
+        std::cerr
+            << "--normals cannot be used with a base or skirt" << std::endl
+            << p.usage();
+        std::exit(1);
+    }
+    // rtin extracts a mesh for the error alone, without the triangulator's
+    // limits, seeds or refinement options
+    if (rtin && (maxTriangles > 0 || maxPoints > 0 || timeLimit > 0 ||
+        maxMemory > 0 || !seedsPath.empty() || lockEdges || lazy ||
+        coarseLevels > 0 || flip || numThreads != 1))
+    {
+        std::cerr
+            << "--rtin cannot be used with -t, -p, -j, --time-limit, "
+            << "--max-memory, --seeds, --lock-edges, --lazy, --coarse or --flip"
+            << std::endl << p.usage();
+        std::exit(1);
+    }
+    // quantized mesh clients build their own skirts from the edge vertices
+    if (skirtDepth > 0 && quantized) {
+        std::cerr
+            << "--skirt cannot be used with a .terrain outfile" << std::endl
+            << p.usage();
+        std::exit(1);
+    }
+    // quantized mesh has no walls or bottom for a solid base
+    if (baseHeight > 0 && quantized) {
+        std::cerr
+            << "--base cannot be used with a .terrain outfile" << std::endl
+            << p.usage();
+        std::exit(1);
+    }
+    // hillshades, each with its own light
+    std::vector<Hillshade> hillshades;
+    if (!shadePath.empty()) {
+        hillshades.push_back({shadePath, shadeAlt, shadeAz});
+    }
+    for (size_t i = 0; i < shadeLights.size();) {
+        size_t j = shadeLights.find(',', i);
+        if (j == std::string::npos) {
+            j = shadeLights.size();
+        }
+        const std::string light = shadeLights.substr(i, j - i);
+        Hillshade hillshade;
+        char *end;
+        hillshade.altitude = std::strtof(light.c_str(), &end);
+        if (*end == ':') {
+            hillshade.azimuth = std::strtof(end + 1, &end);
+        }
+        if (*end != ':' || end[1] == '\0') {
+            std::cerr
+                << "invalid light: " << light << std::endl
+                << p.usage();
+            std::exit(1);
+        }
+        hillshade.path = end + 1;
+        hillshades.push_back(hillshade);
+        i = j + 1;
+    }
+    const int numImages =
+        !normalmapPath.empty() + hillshades.size() + !slopePath.empty();
+    const bool hasOtherFile = numImages > 0;
     if (!hasOutFile && !hasOtherFile) {
         std::cerr << "outfile required" << std::endl << p.usage();
         std::exit(1);
@@ -87,101 +220,362 @@ int main(int argc, char **argv) {
         };
     };
 
-    // load heightmap
-    auto done = timed("loading heightmap");
-    const auto hm = std::make_shared<Heightmap>(inFile);
-    done();
-
-    int w = hm->Width();
-    int h = hm->Height();
-    if (w * h == 0) {
-        std::cerr
-            << "invalid heightmap file (try png, jpg, etc.)" << std::endl
-            << p.usage();
-        std::exit(1);
+    // load fixed points and breaklines
+    std::vector<glm::ivec2> seedPoints;
+    std::vector<std::pair<glm::ivec2, glm::ivec2>> seedLines;
+    if (!seedsPath.empty()) {
+        if (!LoadSeeds(seedsPath, seedPoints, seedLines)) {
+            std::cerr << "invalid seeds file" << std::endl << p.usage();
+            std::exit(1);
+        }
     }
 
-    // display statistics
-    if (!quiet) {
-        printf("  %d x %d = %d pixels\n", w, h, w * h);
+    // in sequence mode, file names are patterns with a printf style integer
+    // conversion (like %d or %04d) for the frame number and %% for a percent
+    // sign; the number is substituted here, rather than handing the pattern
+    // to printf, and the number of conversions is returned (-1 if invalid)
+    const auto formatFrame = [](
+        const std::string &pattern, const int frame, std::string &result)
+    {
+        int count = 0;
+        result.clear();
+        for (size_t i = 0; i < pattern.size(); i++) {
+            if (pattern[i] != '%') {
+                result += pattern[i];
+                continue;
+            }
+            if (i + 1 < pattern.size() && pattern[i + 1] == '%') {
+                result += '%';
+                i++;
+                continue;
+            }
+            // flags and width, then d or i
+            size_t j = i + 1;
+            while (j < pattern.size() && std::strchr("0-+ ", pattern[j])) {
+                j++;
+            }
+            while (j < pattern.size() && std::isdigit(pattern[j])) {
+                j++;
+            }
+            if (j - i > 6 || j >= pattern.size() ||
+                (pattern[j] != 'd' && pattern[j] != 'i'))
+            {
+                return -1;
+            }
+            char buf[64];
+            snprintf(
+                buf, sizeof(buf), (pattern.substr(i, j - i) + "d").c_str(),
+                frame);
+            result += buf;
+            count++;
+            i = j;
+        }
+        return count;
+    };
+    if (numFrames > 0) {
+        std::vector<std::string> patterns = {inFile, outPattern};
+        patterns.push_back(normalmapPath);
+        patterns.push_back(slopePath);
+        for (const Hillshade &hillshade : hillshades) {
+            patterns.push_back(hillshade.path);
+        }
+        for (const std::string &pattern : patterns) {
+            std::string name;
+            const int count = formatFrame(pattern, 0, name);
+            if (pattern.empty() || count == 1 || (count == 0 && numFrames == 1)) {
+                continue;
+            }
+            std::cerr
+                << "file names need one frame number like %d: " << pattern
+                << std::endl << p.usage();
+            std::exit(1);
+        }
     }
+    const auto frameName = [numFrames, &formatFrame](
+        const std::string &pattern, const int frame)
+    {
+        if (numFrames <= 0) {
+            return pattern;
+        }
+        std::string name;
+        formatFrame(pattern, frame, name);
+        return name;
+    };
 
-    // auto level heightmap
-    if (level) {
-        hm->AutoLevel();
-    }
+    // the heightmap and triangulation are kept from frame to frame
+    std::shared_ptr<Heightmap> hm;
+    std::shared_ptr<Heightmap> weights;
+    std::unique_ptr<Triangulator> tri;
 
-    // invert heightmap
-    if (invert) {
-        hm->Invert();
-    }
+    for (int i = 0; i < std::max(numFrames, 1); i++) {
+        const int frame = firstFrame + i;
+        if (numFrames > 0 && !quiet) {
+            printf("frame %d\n", frame);
+        }
 
-    // blur heightmap
-    if (blurSigma > 0) {
-        done = timed("blurring heightmap");
-        hm->GaussianBlur(blurSigma);
+        // load heightmap
+        auto done = timed("loading heightmap");
+        const auto next = std::make_shared<Heightmap>(frameName(inFile, frame));
         done();
-    }
 
-    // apply gamma curve
-    if (gamma > 0) {
-        hm->GammaCurve(gamma);
-    }
+        int w = next->Width();
+        int h = next->Height();
+        if (int64_t(w) * h == 0) {
+            std::cerr
+                << "invalid heightmap file (try png, jpg, etc.)" << std::endl
+                << p.usage();
+            std::exit(1);
+        }
 
-    // add border
-    if (borderSize > 0) {
-        hm->AddBorder(borderSize, borderHeight);
-    }
+        // display statistics
+        if (!quiet) {
+            printf("  %d x %d = %lld pixels\n", w, h, (long long)w * h);
+        }
 
-    // get updated size
-    w = hm->Width();
-    h = hm->Height();
-
-    if (hasOutFile) {
-        // triangulate
-        done = timed("triangulating");
-        Triangulator tri(hm);
-        tri.Run(maxError, maxTriangles, maxPoints);
-        auto points = tri.Points(zScale * zExaggeration);
-        auto triangles = tri.Triangles();
-        done();
+        // load error weights
+        if (!weightsPath.empty() && !weights) {
+            weights = std::make_shared<Heightmap>(weightsPath);
+            if (weights->Width() != w || weights->Height() != h) {
+                std::cerr
+                    << "weight image must match heightmap size" << std::endl
+                    << p.usage();
+                std::exit(1);
+            }
+            if (borderSize > 0) {
+                weights->AddBorder(borderSize, 1);
+            }
+        }
+
+        // auto level heightmap
+        if (level) {
+            next->AutoLevel();
+        }
+
+        // invert heightmap
+        if (invert) {
+            next->Invert();
+        }
 
-        // add base
-        if (baseHeight > 0) {
-            done = timed("adding solid base");
-            const float z = -baseHeight * zScale * zExaggeration;
-            AddBase(points, triangles, w, h, z);
+        // blur heightmap
+        if (blurSigma > 0) {
+            done = timed("blurring heightmap");
+            next->GaussianBlur(blurSigma);
             done();
         }
 
-        // display statistics
-        if (!quiet) {
-            const int naiveTriangleCount = (w - 1) * (h - 1) * 2;
-            printf("  error = %g\n", tri.Error());
-            printf("  points = %ld\n", points.size());
-            printf("  triangles = %ld\n", triangles.size());
-            printf("  vs. naive = %g%%\n", 100.f * triangles.size() / naiveTriangleCount);
+        // apply gamma curve
+        if (gamma > 0) {
+            next->GammaCurve(gamma);
         }
 
-        // write output file
-        done = timed("writing output");
-        const std::string outFile = p.rest()[1];
-        SaveBinarySTL(outFile, points, triangles);
-        done();
-    }
+        // add border
+        if (borderSize > 0) {
+            next->AddBorder(borderSize, borderHeight);
+        }
 
-    // compute normal map
-    if (!normalmapPath.empty()) {
-        done = timed("computing normal map");
-        hm->SaveNormalmap(normalmapPath, zScale * zExaggeration);
-        done();
-    }
+        // get updated size
+        w = next->Width();
+        h = next->Height();
 
-    // compute hillshade image
-    if (!shadePath.empty()) {
-        done = timed("computing hillshade image");
-        hm->SaveHillshade(shadePath, zScale * zExaggeration, shadeAlt, shadeAz);
-        done();
+        if (hm && (w != hm->Width() || h != hm->Height())) {
+            std::cerr
+                << "all frames must have the same size" << std::endl
+                << p.usage();
+            std::exit(1);
+        }
+
+        if (rtin && !Rtin::ValidSize(w, h)) {
+            std::cerr
+                << "rtin requires a square heightmap of size 2^k+1" << std::endl
+                << p.usage();
+            std::exit(1);
+        }
+
+        // limit the number of triangles so that the estimated memory use
+        // stays within the budget: heightmaps and images are per pixel,
+        // triangulator storage and output meshes are per triangle
+        int triangleLimit = maxTriangles;
+        if (maxMemory > 0 && !rtin) {
+            const double pixels = double(w) * h;
+            double fixed = pixels * (numFrames > 0 ? 8 : 4);
+            if (weights) {
+                fixed += pixels * 4;
+            }
+            if (lazy) {
+                fixed += pixels * 8 / 3;
+            }
+            // images are only held as 8-bit pixels; they are encoded a few
+            // strips at a time, and tiled images hold a band of tiles per
+            // zoom level, about two bands in all
+            fixed += (tileSize > 0 ? double(w) * tileSize * 2 : pixels) *
+                numImages * 3;
+            // the parallel regions (grown by doubling) and the merged
+            // result exist together; the output is read in place apart
+            // from its heights, except that adding a base copies it and
+            // then reallocates the copy, briefly holding it three times over
+            // reordering keeps an order and vertex renumbering, and needs
+            // adjacency or sort keys while computing the order; quantized
+            // mesh output renumbers the vertices too
+            const int perTriangle =
+                Triangulator::BytesPerTriangle() * (numThreads == 1 ? 1 : 3) +
+                (baseHeight > 0 ? 54 : 2) + (order != "storage" ? 40 : 0) +
+                (quantized ? 4 : 0);
+            // leave some room for the program itself and small buffers
+            const double budget =
+                (double(maxMemory) - 16) * 1024 * 1024 - fixed;
+            if (budget < perTriangle * 2.0) {
+                std::cerr
+                    << "max memory is too small for the heightmap" << std::endl
+                    << p.usage();
+                std::exit(1);
+            }
+            // and never more than a full grid triangulation
+            const double n = std::min(
+                std::min(budget / perTriangle, 2.0 * w * h), 2e9);
+            if (triangleLimit <= 0 || n < triangleLimit) {
+                triangleLimit = n;
+            }
+        }
+
+        if (hasOutFile) {
+            // triangulate
+            done = timed("triangulating");
+            const auto deadline = std::chrono::steady_clock::now() +
+                std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                    std::chrono::duration<double>(timeLimit));
+            std::unique_ptr<Rtin> rt;
+            float error;
+            if (rtin) {
+                hm = next;
+                rt.reset(new Rtin(hm, weights));
+                rt->Extract(maxError);
+                error = rt->Error();
+            } else if (tri) {
+                // later frames start from the previous triangulation
+                if (timeLimit > 0) {
+                    tri->SetDeadline(deadline);
+                }
+                tri->UpdateFrame(*next, maxError, triangleLimit, maxPoints);
+                error = tri->Error();
+            } else {
+                hm = next;
+                tri.reset(new Triangulator(hm));
+                tri->SetWeights(weights);
+                tri->SetDataFlips(flip);
+                if (timeLimit > 0) {
+                    tri->SetDeadline(deadline);
+                }
+                if (lazy) {
+                    tri->SetPyramid(std::make_shared<MinMaxPyramid>(*hm));
+                }
+                const glm::ivec2 offset(borderSize);
+                for (const glm::ivec2 &q : seedPoints) {
+                    tri->Insert(q + offset);
+                }
+                for (const auto &line : seedLines) {
+                    tri->InsertLine(line.first + offset, line.second + offset, maxError);
+                }
+                if (maxMemory > 0) {
+                    tri->Reserve(triangleLimit);
+                }
+                tri->SeedFromCoarse(coarseLevels, maxError, triangleLimit, maxPoints);
+                if (lockEdges) {
+                    tri->LockBounds(maxError);
+                }
+                if (numThreads == 1) {
+                    tri->Run(maxError, triangleLimit, maxPoints);
+                } else {
+                    tri->RunParallel(maxError, triangleLimit, maxPoints, numThreads);
+                }
+                error = tri->Error();
+            }
+            done();
+
+            // the output is read straight from the triangulation, unless a
+            // base is added, which needs a copy to extend
+            const float z = zScale * zExaggeration;
+            std::vector<glm::vec3> points;
+            std::vector<glm::ivec3> triangles;
+            std::unique_ptr<Mesh> mesh;
+            if (baseHeight > 0) {
+                done = timed("adding solid base");
+                std::vector<int> boundary;
+                if (rt) {
+                    points = rt->Points(z);
+                    triangles = rt->Triangles();
+                    boundary = rt->Boundary();
+                } else {
+                    points = tri->Points(z);
+                    triangles = tri->Triangles();
+                    boundary = tri->Boundary();
+                }
+                AddBase(points, triangles, boundary, w, h, -baseHeight * z);
+                mesh.reset(new VectorMesh(points, triangles));
+                done();
+            } else if (rt) {
+                mesh.reset(new Rtin::MeshView(*rt, z));
+            } else {
+                mesh.reset(new Triangulator::MeshView(*tri, z));
+            }
+
+            // add skirt
+            if (skirtDepth > 0) {
+                const std::vector<int> boundary =
+                    rt ? rt->Boundary() : tri->Boundary();
+                mesh.reset(new SkirtMesh(
+                    std::move(mesh), boundary, skirtDepth * z));
+            }
+
+            // reorder triangles for rendering
+            if (order != "storage") {
+                done = timed("reordering triangles");
+                const std::vector<int> triangleOrder = order == "cache" ?
+                    VertexCacheOrder(*mesh, 16) : HilbertOrder(*mesh);
+                mesh.reset(new ReorderedMesh(std::move(mesh), triangleOrder));
+                done();
+            }
+
+            // display statistics
+            if (!quiet) {
+                const int64_t naiveTriangleCount = int64_t(w - 1) * (h - 1) * 2;
+                printf("  error = %g\n", error);
+                printf("  points = %d\n", mesh->NumPoints());
+                printf("  triangles = %d\n", mesh->NumTriangles());
+                printf("  vs. naive = %g%%\n", 100.f * mesh->NumTriangles() / naiveTriangleCount);
+            }
+
+            // write output file
+            done = timed("writing output");
+            const std::string outFile = frameName(outPattern, frame);
+            if (quantized) {
+                SaveQuantizedMesh(outFile, *mesh);
+            } else if (glb) {
+                SaveGLB(
+                    outFile, *mesh, quantize,
+                    vertexNormals ? hm.get() : nullptr, zScale * zExaggeration);
+            } else {
+                SaveBinarySTL(outFile, *mesh);
+            }
+            done();
+        } else {
+            hm = next;
+        }
+
+        // compute normal map, hillshade and slope images together
+        if (numImages > 0) {
+            done = timed("computing images");
+            std::vector<Hillshade> frameHillshades = hillshades;
+            for (Hillshade &hillshade : frameHillshades) {
+                hillshade.path = frameName(hillshade.path, frame);
+            }
+            hm->SaveImages(
+                zScale * zExaggeration,
+                normalmapPath.empty() ? "" : frameName(normalmapPath, frame),
+                frameHillshades,
+                slopePath.empty() ? "" : frameName(slopePath, frame),
+                tileSize, imageThreads);
+            done();
+        }
     }
 
     // show total elapsed time
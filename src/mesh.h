@@ -0,0 +1,49 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+
+// read-only access to a triangle mesh by index, so that writers can read a
+// mesh where it is stored instead of from a copy
+class Mesh {
+public:
+    virtual ~Mesh() {}
+
+    virtual int NumPoints() const = 0;
+
+    virtual int NumTriangles() const = 0;
+
+    virtual glm::vec3 Point(const int i) const = 0;
+
+    virtual glm::ivec3 Triangle(const int i) const = 0;
+};
+
+// a mesh held in point and triangle vectors, e.g. after adding a base
+class VectorMesh : public Mesh {
+public:
+    VectorMesh(
+        const std::vector<glm::vec3> &points,
+        const std::vector<glm::ivec3> &triangles) :
+        m_Points(points),
+        m_Triangles(triangles) {}
+
+    int NumPoints() const override {
+        return m_Points.size();
+    }
+
+    int NumTriangles() const override {
+        return m_Triangles.size();
+    }
+
+    glm::vec3 Point(const int i) const override {
+        return m_Points[i];
+    }
+
+    glm::ivec3 Triangle(const int i) const override {
+        return m_Triangles[i];
+    }
+
+private:
+    const std::vector<glm::vec3> &m_Points;
+    const std::vector<glm::ivec3> &m_Triangles;
+};
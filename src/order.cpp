@@ -0,0 +1,186 @@
+#include "order.h"
+
+#include <algorithm>
+#include <cstdint>
+
+ReorderedMesh::ReorderedMesh(
+    std::unique_ptr<Mesh> mesh,
+    const std::vector<int> &order) :
+    m_Mesh(std::move(mesh)),
+    m_Order(order),
+    m_Indexes(m_Mesh->NumPoints(), -1)
+{
+    for (const int i : m_Order) {
+        const glm::ivec3 t = m_Mesh->Triangle(i);
+        for (int j = 0; j < 3; j++) {
+            int &index = m_Indexes[t[j]];
+            if (index < 0) {
+                index = m_Points.size();
+                m_Points.push_back(t[j]);
+            }
+        }
+    }
+}
+
+std::vector<int> VertexCacheOrder(const Mesh &mesh, const int cacheSize) {
+    const int numPoints = mesh.NumPoints();
+    const int numTriangles = mesh.NumTriangles();
+
+    // triangles around each vertex, as ranges of one flat array
+    std::vector<int> offsets(numPoints + 1, 0);
+    for (int i = 0; i < numTriangles; i++) {
+        const glm::ivec3 t = mesh.Triangle(i);
+        offsets[t.x + 1]++;
+        offsets[t.y + 1]++;
+        offsets[t.z + 1]++;
+    }
+    for (int i = 0; i < numPoints; i++) {
+        offsets[i + 1] += offsets[i];
+    }
+    std::vector<int> adjacent(offsets[numPoints]);
+    {
+        std::vector<int> next(offsets.begin(), offsets.end() - 1);
+        for (int i = 0; i < numTriangles; i++) {
+            const glm::ivec3 t = mesh.Triangle(i);
+            adjacent[next[t.x]++] = i;
+            adjacent[next[t.y]++] = i;
+            adjacent[next[t.z]++] = i;
+        }
+    }
+
+    // live triangle count and time of entering the cache, per vertex; a
+    // vertex is in the cache while time - cacheTime <= cacheSize
+    std::vector<int> live(numPoints);
+    for (int i = 0; i < numPoints; i++) {
+        live[i] = offsets[i + 1] - offsets[i];
+    }
+    std::vector<int> cacheTime(numPoints, 0);
+    std::vector<bool> emitted(numTriangles, false);
+    std::vector<int> deadEnd;
+    std::vector<int> candidates;
+    std::vector<int> order;
+    order.reserve(numTriangles);
+
+    int time = cacheSize + 1;
+    int cursor = 0;
+    int fan = 0;
+    while (fan >= 0) {
+        // emit all remaining triangles around the fanning vertex
+        candidates.clear();
+        for (int k = offsets[fan]; k < offsets[fan + 1]; k++) {
+            const int i = adjacent[k];
+            if (emitted[i]) {
+                continue;
+            }
+            const glm::ivec3 t = mesh.Triangle(i);
+            for (int j = 0; j < 3; j++) {
+                const int v = t[j];
+                deadEnd.push_back(v);
+                candidates.push_back(v);
+                live[v]--;
+                if (time - cacheTime[v] > cacheSize) {
+                    cacheTime[v] = time++;
+                }
+            }
+            emitted[i] = true;
+            order.push_back(i);
+        }
+
+        // continue with the candidate that stays in the cache longest
+        // while it is fanned, if any will
+        int best = -1;
+        int bestPriority = -1;
+        for (const int v : candidates) {
+            if (live[v] <= 0) {
+                continue;
+            }
+            int priority = 0;
+            if (time - cacheTime[v] + 2 * live[v] <= cacheSize) {
+                priority = time - cacheTime[v];
+            }
+            if (priority > bestPriority) {
+                bestPriority = priority;
+                best = v;
+            }
+        }
+
+        // otherwise, go back to a recently used vertex, or the next one in
+        // input order, that still has triangles left
+        while (best < 0 && !deadEnd.empty()) {
+            const int v = deadEnd.back();
+            deadEnd.pop_back();
+            if (live[v] > 0) {
+                best = v;
+            }
+        }
+        while (best < 0 && cursor < numPoints) {
+            if (live[cursor] > 0) {
+                best = cursor;
+            }
+            cursor++;
+        }
+        fan = best;
+    }
+    return order;
+}
+
+namespace {
+
+// distance of (x, y) along a Hilbert curve filling an n x n grid, where n
+// is a power of two
+uint64_t HilbertIndex(const uint32_t n, uint32_t x, uint32_t y) {
+    uint64_t d = 0;
+    for (uint32_t s = n / 2; s > 0; s /= 2) {
+        const uint32_t rx = (x & s) > 0;
+        const uint32_t ry = (y & s) > 0;
+        d += uint64_t(s) * s * ((3 * rx) ^ ry);
+        // rotate the quadrant
+        if (ry == 0) {
+            if (rx == 1) {
+                x = n - 1 - x;
+                y = n - 1 - y;
+            }
+            std::swap(x, y);
+        }
+    }
+    return d;
+}
+
+}
+
+std::vector<int> HilbertOrder(const Mesh &mesh) {
+    const int numPoints = mesh.NumPoints();
+    const int numTriangles = mesh.NumTriangles();
+
+    // points are on the pixel grid; centroids are kept at a third of a
+    // pixel by scaling by 3
+    glm::vec2 lo(0);
+    glm::vec2 hi(0);
+    for (int i = 0; i < numPoints; i++) {
+        const glm::vec2 p = glm::vec2(mesh.Point(i).x, mesh.Point(i).y);
+        lo = i ? glm::min(lo, p) : p;
+        hi = i ? glm::max(hi, p) : p;
+    }
+    const glm::vec2 size = (hi - lo) * 3.f;
+    uint32_t n = 1;
+    while (n <= std::max(size.x, size.y) && n < (1u << 31)) {
+        n *= 2;
+    }
+
+    std::vector<std::pair<uint64_t, int>> keys(numTriangles);
+    for (int i = 0; i < numTriangles; i++) {
+        const glm::ivec3 t = mesh.Triangle(i);
+        const glm::vec3 sum =
+            mesh.Point(t.x) + mesh.Point(t.y) + mesh.Point(t.z);
+        const glm::vec2 c = glm::vec2(sum.x, sum.y) - lo * 3.f;
+        keys[i] = std::make_pair(
+            HilbertIndex(n, uint32_t(c.x + 0.5f), uint32_t(c.y + 0.5f)), i);
+    }
+    std::sort(keys.begin(), keys.end());
+
+    std::vector<int> order(numTriangles);
+    for (int i = 0; i < numTriangles; i++) {
+        order[i] = keys[i].second;
+    }
+    return order;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "mesh.h"
+
+// a mesh with its triangles in the given order (as indexes into the
+// original mesh) and its points numbered in order of first use, so that
+// consecutive triangles also refer to nearby vertices
+class ReorderedMesh : public Mesh {
+public:
+    ReorderedMesh(std::unique_ptr<Mesh> mesh, const std::vector<int> &order);
+
+    int NumPoints() const override {
+        return m_Points.size();
+    }
+
+    int NumTriangles() const override {
+        return m_Order.size();
+    }
+
+    glm::vec3 Point(const int i) const override {
+        return m_Mesh->Point(m_Points[i]);
+    }
+
+    glm::ivec3 Triangle(const int i) const override {
+        const glm::ivec3 t = m_Mesh->Triangle(m_Order[i]);
+        return glm::ivec3(m_Indexes[t.x], m_Indexes[t.y], m_Indexes[t.z]);
+    }
+
+private:
+    std::unique_ptr<Mesh> m_Mesh;
+    std::vector<int> m_Order;
+    std::vector<int> m_Points;
+    std::vector<int> m_Indexes;
+};
+
+// triangle order for a GPU post-transform vertex cache holding cacheSize
+// vertices, using Tipsify (Sander et al. 2007)
+std::vector<int> VertexCacheOrder(const Mesh &mesh, const int cacheSize);
+
+// triangle order along a Hilbert curve through the triangle centroids
+std::vector<int> HilbertOrder(const Mesh &mesh);
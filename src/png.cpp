@@ -0,0 +1,434 @@
+#include "png.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <thread>
+#include <vector>
+
+namespace {
+
+const int kWindowSize = 1 << 15;
+const int kHashBits = 15;
+const int kMaxChain = 8;
+const int kMaxMatch = 258;
+// matches at least this long end the search, and aren't checked for a
+// longer match at the next byte
+const int kGoodMatch = 32;
+const int kStripBytes = 1 << 20;
+
+const uint16_t kLengthBase[] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59,
+    67, 83, 99, 115, 131, 163, 195, 227, 258};
+const uint8_t kLengthExtra[] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+    4, 4, 4, 4, 5, 5, 5, 5, 0};
+const uint16_t kDistanceBase[] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385,
+    513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+const uint8_t kDistanceExtra[] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7,
+    8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+uint32_t Reverse(const uint32_t code, const int bits) {
+    uint32_t result = 0;
+    for (int i = 0; i < bits; i++) {
+        result |= ((code >> i) & 1) << (bits - 1 - i);
+    }
+    return result;
+}
+
+// the fixed huffman codes of deflate, bit reversed since codes are stored
+// most significant bit first
+struct FixedCodes {
+    uint16_t literal[288];
+    uint8_t literalBits[288];
+    uint8_t distance[30];
+
+    FixedCodes() {
+        for (int i = 0; i < 288; i++) {
+            if (i < 144) {
+                literal[i] = Reverse(0x30 + i, 8);
+                literalBits[i] = 8;
+            } else if (i < 256) {
+                literal[i] = Reverse(0x190 + i - 144, 9);
+                literalBits[i] = 9;
+            } else if (i < 280) {
+                literal[i] = Reverse(i - 256, 7);
+                literalBits[i] = 7;
+            } else {
+                literal[i] = Reverse(0xc0 + i - 280, 8);
+                literalBits[i] = 8;
+            }
+        }
+        for (int i = 0; i < 30; i++) {
+            distance[i] = Reverse(i, 5);
+        }
+    }
+};
+
+// appends bits to a byte vector, least significant bit first
+class BitWriter {
+public:
+    BitWriter(std::vector<uint8_t> &out) :
+        m_Out(out), m_Bits(0), m_Count(0) {}
+
+    void Write(const uint32_t bits, const int count) {
+        m_Bits |= uint64_t(bits) << m_Count;
+        m_Count += count;
+        while (m_Count >= 8) {
+            m_Out.push_back(m_Bits);
+            m_Bits >>= 8;
+            m_Count -= 8;
+        }
+    }
+
+    void Align() {
+        if (m_Count > 0) {
+            Write(0, 8 - m_Count);
+        }
+    }
+
+private:
+    std::vector<uint8_t> &m_Out;
+    uint64_t m_Bits;
+    int m_Count;
+};
+
+// compresses data as one fixed huffman block, matching strings within the
+// data only; unless it is the last, the block is followed by an empty
+// stored block so that the output ends on a byte boundary and the next
+// strip's blocks can simply be appended
+void Deflate(
+    const uint8_t *data, const int size, const bool last,
+    std::vector<uint8_t> &out)
+{
+    static const FixedCodes codes;
+    BitWriter writer(out);
+    const auto symbol = [&writer](const int i) {
+        writer.Write(codes.literal[i], codes.literalBits[i]);
+    };
+    writer.Write(last ? 1 : 0, 1);
+    writer.Write(1, 2);
+
+    // hash chains of earlier positions with the same next three bytes
+    std::vector<int> head(1 << kHashBits, -1);
+    std::vector<int> prev(kWindowSize);
+    const auto hash = [data](const int i) {
+        const uint32_t v = data[i] | (data[i + 1] << 8) | (data[i + 2] << 16);
+        return (v * 2654435761u) >> (32 - kHashBits);
+    };
+    const auto insert = [&](const int i) {
+        const uint32_t h = hash(i);
+        prev[i & (kWindowSize - 1)] = head[h];
+        head[h] = i;
+    };
+    const auto findMatch = [&](const int i, int &distance) {
+        const int limit = std::min(kMaxMatch, size - i);
+        int best = 0;
+        int chain = kMaxChain;
+        for (int j = head[hash(i)];
+            j >= 0 && i - j < kWindowSize && chain > 0;
+            j = prev[j & (kWindowSize - 1)], chain--)
+        {
+            if (data[j + best] != data[i + best]) {
+                continue;
+            }
+            int n = 0;
+            while (n + 8 <= limit) {
+                uint64_t a, b;
+                std::memcpy(&a, data + j + n, 8);
+                std::memcpy(&b, data + i + n, 8);
+                if (a != b) {
+                    n += __builtin_ctzll(a ^ b) / 8;
+                    break;
+                }
+                n += 8;
+            }
+            if (n + 8 > limit) {
+                while (n < limit && data[j + n] == data[i + n]) {
+                    n++;
+                }
+            }
+            if (n > best) {
+                best = n;
+                distance = i - j;
+                if (n >= kGoodMatch || n == limit) {
+                    break;
+                }
+            }
+        }
+        return best;
+    };
+
+    int i = 0;
+    while (i < size) {
+        int length = 0;
+        int distance = 0;
+        if (size - i >= 3) {
+            length = findMatch(i, distance);
+            insert(i);
+        }
+        // emit a literal instead if the next byte starts a longer match
+        if (length >= 3 && length < kGoodMatch && size - i > 3) {
+            int nextDistance;
+            if (findMatch(i + 1, nextDistance) > length) {
+                length = 0;
+            }
+        }
+        if (length < 3) {
+            symbol(data[i]);
+            i++;
+            continue;
+        }
+        const int lengthCode = std::upper_bound(
+            kLengthBase, kLengthBase + 29, length) - kLengthBase - 1;
+        symbol(257 + lengthCode);
+        writer.Write(
+            length - kLengthBase[lengthCode], kLengthExtra[lengthCode]);
+        const int distanceCode = std::upper_bound(
+            kDistanceBase, kDistanceBase + 30, distance) - kDistanceBase - 1;
+        writer.Write(codes.distance[distanceCode], 5);
+        writer.Write(
+            distance - kDistanceBase[distanceCode],
+            kDistanceExtra[distanceCode]);
+        for (int k = 1; k < length && size - (i + k) >= 3; k++) {
+            insert(i + k);
+        }
+        i += length;
+    }
+
+    symbol(256);
+    if (!last) {
+        writer.Write(0, 3);
+    }
+    writer.Align();
+    if (!last) {
+        const uint8_t stored[] = {0, 0, 0xff, 0xff};
+        out.insert(out.end(), stored, stored + 4);
+    }
+}
+
+uint32_t Adler32(const uint8_t *data, size_t size) {
+    uint32_t a = 1;
+    uint32_t b = 0;
+    while (size > 0) {
+        const size_t n = std::min<size_t>(size, 5552);
+        for (size_t i = 0; i < n; i++) {
+            a += data[i];
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+        data += n;
+        size -= n;
+    }
+    return (b << 16) | a;
+}
+
+// the adler-32 of two pieces of data joined, from their separate checksums
+// and the size of the second
+uint32_t CombineAdler32(const uint32_t a1, const uint32_t a2, const size_t size2) {
+    const uint32_t base = 65521;
+    const uint32_t rem = size2 % base;
+    uint32_t sum1 = a1 & 0xffff;
+    uint32_t sum2 = uint64_t(rem) * sum1 % base;
+    sum1 += (a2 & 0xffff) + base - 1;
+    sum2 += (a1 >> 16) + (a2 >> 16) + base - rem;
+    sum1 %= base;
+    sum2 %= base;
+    return (sum2 << 16) | sum1;
+}
+
+uint32_t Crc32(const uint8_t *data, const size_t size, uint32_t crc) {
+    static const std::vector<uint32_t> table = [] {
+        std::vector<uint32_t> table(256);
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+            }
+            table[i] = c;
+        }
+        return table;
+    }();
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++) {
+        crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+void PutBigEndian(uint8_t *p, const uint32_t value) {
+    p[0] = value >> 24;
+    p[1] = value >> 16;
+    p[2] = value >> 8;
+    p[3] = value;
+}
+
+int Paeth(const int a, const int b, const int c) {
+    const int p = a + b - c;
+    const int pa = std::abs(p - a);
+    const int pb = std::abs(p - b);
+    const int pc = std::abs(p - c);
+    if (pa <= pb && pa <= pc) {
+        return a;
+    }
+    return pb <= pc ? b : c;
+}
+
+// filters a row with the given predictor of each byte from the bytes to
+// its left (a), above (b) and above left (c), returning the sum of the
+// absolute filtered values
+template <typename F>
+int64_t FilterRow(
+    const uint8_t *row, const uint8_t *prior, const int size, const int bpp,
+    uint8_t *out, const F &predict)
+{
+    int64_t sum = 0;
+    for (int i = 0; i < size; i++) {
+        const int a = i >= bpp ? row[i - bpp] : 0;
+        const int c = i >= bpp ? prior[i - bpp] : 0;
+        out[i] = row[i] - predict(a, prior[i], c);
+        sum += std::abs(int(int8_t(out[i])));
+    }
+    return sum;
+}
+
+// filters a row with whichever png filter gives the smallest sum of
+// absolute values, writing the filter type followed by the filtered row
+void FilterRow(
+    const uint8_t *row, const uint8_t *prior, const int size, const int bpp,
+    uint8_t *out, uint8_t *scratch)
+{
+    int64_t best = -1;
+    for (int filter = 0; filter < 5; filter++) {
+        int64_t sum = 0;
+        switch (filter) {
+        case 0:
+            sum = FilterRow(row, prior, size, bpp, scratch,
+                [](int, int, int) { return 0; });
+            break;
+        case 1:
+            sum = FilterRow(row, prior, size, bpp, scratch,
+                [](int a, int, int) { return a; });
+            break;
+        case 2:
+            sum = FilterRow(row, prior, size, bpp, scratch,
+                [](int, int b, int) { return b; });
+            break;
+        case 3:
+            sum = FilterRow(row, prior, size, bpp, scratch,
+                [](int a, int b, int) { return (a + b) / 2; });
+            break;
+        case 4:
+            sum = FilterRow(row, prior, size, bpp, scratch, Paeth);
+            break;
+        }
+        if (best < 0 || sum < best) {
+            best = sum;
+            out[0] = filter;
+            std::memcpy(out + 1, scratch, size);
+        }
+    }
+}
+
+}
+
+void SavePNG(
+    const std::string &path,
+    const int width, const int height, const int channels,
+    const uint8_t *data, const int numThreads)
+{
+    const int stride = width * channels;
+    const int rowsPerStrip = std::max(1, kStripBytes / (stride + 1));
+    const int numStrips = (height + rowsPerStrip - 1) / rowsPerStrip;
+    const int maxThreads = numThreads > 0 ?
+        numThreads : int(std::thread::hardware_concurrency());
+    const int batchSize = std::max(1, std::min(maxThreads, numStrips));
+
+    std::fstream file(path, std::ios::out | std::ios::binary);
+    const auto chunk = [&file](
+        const char *type, const uint8_t *data, const size_t size)
+    {
+        uint8_t header[8];
+        PutBigEndian(header, size);
+        std::memcpy(header + 4, type, 4);
+        uint8_t crc[4];
+        PutBigEndian(crc, Crc32(data, size, Crc32(header + 4, 4, 0)));
+        file.write(reinterpret_cast<const char *>(header), 8);
+        file.write(reinterpret_cast<const char *>(data), size);
+        file.write(reinterpret_cast<const char *>(crc), 4);
+    };
+
+    const uint8_t signature[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    file.write(reinterpret_cast<const char *>(signature), 8);
+    const uint8_t colorTypes[] = {0, 4, 2, 6};
+    uint8_t ihdr[13] = {0};
+    PutBigEndian(ihdr, width);
+    PutBigEndian(ihdr + 4, height);
+    ihdr[8] = 8;
+    ihdr[9] = colorTypes[channels - 1];
+    chunk("IHDR", ihdr, 13);
+
+    // the image data is a single zlib stream, made of the strips' deflate
+    // blocks; each batch of strips is compressed in parallel and written
+    // out as idat chunks before the next one starts
+    const std::vector<uint8_t> zeros(stride, 0);
+    std::vector<std::vector<uint8_t>> compressed(batchSize);
+    std::vector<uint32_t> checksums(batchSize);
+    std::vector<size_t> sizes(batchSize);
+    uint32_t checksum = 1;
+    for (int first = 0; first < numStrips; first += batchSize) {
+        const int count = std::min(batchSize, numStrips - first);
+        const auto encode = [&](const int i) {
+            const int strip = first + i;
+            const int y0 = strip * rowsPerStrip;
+            const int y1 = std::min(height, y0 + rowsPerStrip);
+            std::vector<uint8_t> filtered(size_t(y1 - y0) * (stride + 1));
+            std::vector<uint8_t> scratch(stride);
+            for (int y = y0; y < y1; y++) {
+                FilterRow(
+                    data + int64_t(y) * stride,
+                    y > 0 ? data + int64_t(y - 1) * stride : zeros.data(),
+                    stride, channels,
+                    &filtered[size_t(y - y0) * (stride + 1)], scratch.data());
+            }
+            compressed[i].clear();
+            if (strip == 0) {
+                // deflate with a 32K window, no preset dictionary
+                compressed[i].push_back(0x78);
+                compressed[i].push_back(0x01);
+            }
+            Deflate(
+                filtered.data(), filtered.size(), strip == numStrips - 1,
+                compressed[i]);
+            checksums[i] = Adler32(filtered.data(), filtered.size());
+            sizes[i] = filtered.size();
+        };
+        if (count == 1) {
+            encode(0);
+        } else {
+            std::vector<std::thread> threads;
+            for (int i = 0; i < count; i++) {
+                threads.emplace_back(encode, i);
+            }
+            for (std::thread &thread : threads) {
+                thread.join();
+            }
+        }
+        for (int i = 0; i < count; i++) {
+            checksum = CombineAdler32(checksum, checksums[i], sizes[i]);
+            if (first + i == numStrips - 1) {
+                uint8_t adler[4];
+                PutBigEndian(adler, checksum);
+                compressed[i].insert(compressed[i].end(), adler, adler + 4);
+            }
+            chunk("IDAT", compressed[i].data(), compressed[i].size());
+        }
+    }
+
+    chunk("IEND", nullptr, 0);
+    file.close();
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// writes an 8-bit grayscale, RGB or RGBA png; strips of rows are filtered
+// and compressed on the given number of threads (0 for all cores) and
+// written out as soon as they are ready
+void SavePNG(
+    const std::string &path,
+    const int width, const int height, const int channels,
+    const uint8_t *data, const int numThreads = 0);
@@ -0,0 +1,150 @@
+#include "pyramid.h"
+
+#include <algorithm>
+
+MinMaxPyramid::MinMaxPyramid(const Heightmap &heightmap) {
+    // the first level holds 2 x 2 pixel blocks, each further level merges
+    // 2 x 2 blocks of the previous one
+    int w = heightmap.Width();
+    int h = heightmap.Height();
+    do {
+        w = (w + 1) / 2;
+        h = (h + 1) / 2;
+        m_Widths.push_back(w);
+        m_Heights.push_back(h);
+        m_Levels.emplace_back(size_t(w) * h);
+    } while (w > 1 || h > 1);
+
+    Update(heightmap,
+        glm::ivec2(0), glm::ivec2(heightmap.Width(), heightmap.Height()) - 1);
+}
+
+void MinMaxPyramid::Update(
+    const Heightmap &heightmap, glm::ivec2 min, glm::ivec2 max)
+{
+    const int hw = heightmap.Width();
+    const int hh = heightmap.Height();
+    min /= 2;
+    max /= 2;
+    std::vector<glm::vec2> &first = m_Levels[0];
+    const int fw = m_Widths[0];
+    for (int y = min.y; y <= max.y; y++) {
+        for (int x = min.x; x <= max.x; x++) {
+            const int x0 = x * 2;
+            const int y0 = y * 2;
+            const int x1 = std::min(x0 + 1, hw - 1);
+            const int y1 = std::min(y0 + 1, hh - 1);
+            const float a = heightmap.At(x0, y0);
+            const float b = heightmap.At(x1, y0);
+            const float c = heightmap.At(x0, y1);
+            const float d = heightmap.At(x1, y1);
+            first[int64_t(y) * fw + x] = glm::vec2(
+                std::min(std::min(a, b), std::min(c, d)),
+                std::max(std::max(a, b), std::max(c, d)));
+        }
+    }
+
+    for (int i = 1; i < m_Levels.size(); i++) {
+        const std::vector<glm::vec2> &prev = m_Levels[i - 1];
+        std::vector<glm::vec2> &next = m_Levels[i];
+        const int pw = m_Widths[i - 1];
+        const int ph = m_Heights[i - 1];
+        const int w = m_Widths[i];
+        min /= 2;
+        max /= 2;
+        for (int y = min.y; y <= max.y; y++) {
+            for (int x = min.x; x <= max.x; x++) {
+                const int x0 = x * 2;
+                const int y0 = y * 2;
+                const int x1 = std::min(x0 + 1, pw - 1);
+                const int y1 = std::min(y0 + 1, ph - 1);
+                const glm::vec2 a = prev[int64_t(y0) * pw + x0];
+                const glm::vec2 b = prev[int64_t(y0) * pw + x1];
+                const glm::vec2 c = prev[int64_t(y1) * pw + x0];
+                const glm::vec2 d = prev[int64_t(y1) * pw + x1];
+                next[int64_t(y) * w + x] = glm::vec2(
+                    std::min(std::min(a.x, b.x), std::min(c.x, d.x)),
+                    std::max(std::max(a.y, b.y), std::max(c.y, d.y)));
+            }
+        }
+    }
+}
+
+float MinMaxPyramid::ErrorBound(
+    const glm::ivec2 p0, const glm::ivec2 p1, const glm::ivec2 p2,
+    const float z0, const float z1, const float z2) const
+{
+    const auto edge = [](
+        const glm::ivec2 a, const glm::ivec2 b, const glm::ivec2 c)
+    {
+        return int64_t(b.x - c.x) * (a.y - c.y) -
+            int64_t(b.y - c.y) * (a.x - c.x);
+    };
+
+    // true if the rectangle is entirely outside edge a-b
+    const auto outside = [&edge](
+        const glm::ivec2 a, const glm::ivec2 b,
+        const glm::ivec2 min, const glm::ivec2 max)
+    {
+        return
+            edge(a, b, glm::ivec2(min.x, min.y)) < 0 &&
+            edge(a, b, glm::ivec2(max.x, min.y)) < 0 &&
+            edge(a, b, glm::ivec2(min.x, max.y)) < 0 &&
+            edge(a, b, glm::ivec2(max.x, max.y)) < 0;
+    };
+
+    // triangle bounding box
+    const glm::ivec2 min = glm::min(glm::min(p0, p1), p2);
+    const glm::ivec2 max = glm::max(glm::max(p0, p1), p2);
+
+    // plane gradient
+    const glm::vec2 d1(p1 - p0);
+    const glm::vec2 d2(p2 - p0);
+    const float det = d1.x * d2.y - d1.y * d2.x;
+    const float gx = ((z1 - z0) * d2.y - (z2 - z0) * d1.y) / det;
+    const float gy = ((z2 - z0) * d1.x - (z1 - z0) * d2.x) / det;
+
+    // the plane never leaves the vertex heights inside the triangle
+    const float lo = std::min(std::min(z0, z1), z2);
+    const float hi = std::max(std::max(z0, z1), z2);
+
+    // pick the finest level where the box spans at most 5 x 5 blocks of
+    // 2^k x 2^k pixels (level i holds blocks of 2^(i+1) pixels)
+    const int extent = std::max(max.x - min.x, max.y - min.y);
+    int k = 1;
+    while ((extent >> k) >= 4) {
+        k++;
+    }
+    k = std::min(k, int(m_Levels.size()));
+    const std::vector<glm::vec2> &level = m_Levels[k - 1];
+    const int w = m_Widths[k - 1];
+
+    float result = 0;
+    for (int by = min.y >> k; by <= max.y >> k; by++) {
+        for (int bx = min.x >> k; bx <= max.x >> k; bx++) {
+            // block rectangle, clipped to the bounding box
+            const glm::ivec2 b0 = glm::max(glm::ivec2(bx, by) * (1 << k), min);
+            const glm::ivec2 b1 = glm::min(
+                glm::ivec2(bx + 1, by + 1) * (1 << k) - 1, max);
+            if (outside(p0, p1, b0, b1) ||
+                outside(p1, p2, b0, b1) ||
+                outside(p2, p0, b0, b1))
+            {
+                continue;
+            }
+
+            // range of the plane over the block
+            const float z = z0 + gx * (b0.x - p0.x) + gy * (b0.y - p0.y);
+            const float dx = gx * (b1.x - b0.x);
+            const float dy = gy * (b1.y - b0.y);
+            const float pmin = std::max(
+                lo, z + std::min(dx, 0.f) + std::min(dy, 0.f));
+            const float pmax = std::min(
+                hi, z + std::max(dx, 0.f) + std::max(dy, 0.f));
+
+            const glm::vec2 r = level[int64_t(by) * w + bx];
+            result = std::max(result, std::max(r.y - pmin, pmax - r.x));
+        }
+    }
+    return result;
+}
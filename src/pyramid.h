@@ -0,0 +1,29 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+
+#include "heightmap.h"
+
+// stores the min and max heights of 2^k x 2^k pixel blocks, for cheap
+// conservative bounds on the error of large triangles
+class MinMaxPyramid {
+public:
+    MinMaxPyramid(const Heightmap &heightmap);
+
+    // recomputes the blocks covering the given (inclusive) rectangle,
+    // after the heightmap changed there
+    void Update(const Heightmap &heightmap, glm::ivec2 min, glm::ivec2 max);
+
+    // returns an upper bound for the largest difference between the
+    // heightmap and the plane through the triangle's vertices (with the
+    // given heights) over the pixels of the triangle
+    float ErrorBound(
+        const glm::ivec2 p0, const glm::ivec2 p1, const glm::ivec2 p2,
+        const float z0, const float z1, const float z2) const;
+
+private:
+    std::vector<int> m_Widths;
+    std::vector<int> m_Heights;
+    std::vector<std::vector<glm::vec2>> m_Levels;
+};
@@ -0,0 +1,224 @@
+#include "rtin.h"
+
+#include <algorithm>
+#include <cmath>
+
+Rtin::Rtin(
+    const std::shared_ptr<Heightmap> &heightmap,
+    const std::shared_ptr<Heightmap> &weights) :
+    m_Heightmap(heightmap),
+    m_Weights(weights),
+    m_Size(heightmap->Width()),
+    m_Errors(size_t(m_Size) * m_Size),
+    m_Indexes(size_t(m_Size) * m_Size, -1),
+    m_Error(0)
+{
+    ComputeErrors();
+}
+
+bool Rtin::ValidSize(const int width, const int height) {
+    const int n = width - 1;
+    return width == height && n >= 2 && (n & (n - 1)) == 0;
+}
+
+void Rtin::ComputeErrors() {
+    const Heightmap &hm = *m_Heightmap;
+    const Heightmap *weights = m_Weights.get();
+    const int n = m_Size;
+    const int max = n - 1;
+
+    const auto error = [this, n](const int x, const int y) -> float & {
+        return m_Errors[int64_t(y) * n + x];
+    };
+
+    // error at the midpoint m of the hypotenuse ab, if it is not a vertex
+    const auto local = [&hm, weights](
+        const int ax, const int ay, const int bx, const int by,
+        const int mx, const int my)
+    {
+        const float z = (hm.At(ax, ay) + hm.At(bx, by)) / 2;
+        const float e = std::abs(z - hm.At(mx, my));
+        return weights ? e * weights->At(mx, my) : e;
+    };
+
+    // every pixel but the corners is the midpoint of exactly one possible
+    // hypotenuse; levels go from small to large triangles, so that each
+    // error also covers the errors of the children of that split
+    for (int s = 1; s <= max / 2; s *= 2) {
+        const int h = s / 2;
+
+        // horizontal hypotenuses of length 2s, whose children have
+        // diagonal hypotenuses with midpoints above and below
+        for (int y = 0; y <= max; y += s * 2) {
+            for (int x = s; x < max; x += s * 2) {
+                float e = local(x - s, y, x + s, y, x, y);
+                if (s > 1) {
+                    if (y > 0) {
+                        e = std::max(e, error(x - h, y - h));
+                        e = std::max(e, error(x + h, y - h));
+                    }
+                    if (y < max) {
+                        e = std::max(e, error(x - h, y + h));
+                        e = std::max(e, error(x + h, y + h));
+                    }
+                }
+                error(x, y) = e;
+            }
+        }
+
+        // vertical hypotenuses of length 2s
+        for (int y = s; y < max; y += s * 2) {
+            for (int x = 0; x <= max; x += s * 2) {
+                float e = local(x, y - s, x, y + s, x, y);
+                if (s > 1) {
+                    if (x > 0) {
+                        e = std::max(e, error(x - h, y - h));
+                        e = std::max(e, error(x - h, y + h));
+                    }
+                    if (x < max) {
+                        e = std::max(e, error(x + h, y - h));
+                        e = std::max(e, error(x + h, y + h));
+                    }
+                }
+                error(x, y) = e;
+            }
+        }
+
+        // diagonal hypotenuses across 2s x 2s squares; the diagonal runs
+        // through the corner at the center of the parent square, and the
+        // children have the four sides of the square as hypotenuses
+        for (int y = s; y < max; y += s * 2) {
+            for (int x = s; x < max; x += s * 2) {
+                const int ax = x % (s * 4) == s ? x + s : x - s;
+                const int ay = y % (s * 4) == s ? y + s : y - s;
+                float e = local(ax, ay, x * 2 - ax, y * 2 - ay, x, y);
+                e = std::max(e, error(x - s, y));
+                e = std::max(e, error(x + s, y));
+                e = std::max(e, error(x, y - s));
+                e = std::max(e, error(x, y + s));
+                error(x, y) = e;
+            }
+        }
+    }
+}
+
+void Rtin::Extract(const float maxError) {
+    for (const glm::ivec2 &p : m_Points) {
+        m_Indexes[int64_t(p.y) * m_Size + p.x] = -1;
+    }
+    m_Points.clear();
+    m_Triangles.clear();
+    m_Error = 0;
+
+    const int max = m_Size - 1;
+    Split(glm::ivec2(0), glm::ivec2(max), glm::ivec2(max, 0), maxError);
+    Split(glm::ivec2(max), glm::ivec2(0), glm::ivec2(0, max), maxError);
+
+    // the split errors only cover the midpoints, so scan the pixels of the
+    // final triangles for the error actually reached
+    for (int i = 0; i < m_Triangles.size(); i += 3) {
+        const std::pair<glm::ivec2, float> candidate =
+            m_Heightmap->FindCandidate(
+                m_Points[m_Triangles[i + 0]],
+                m_Points[m_Triangles[i + 1]],
+                m_Points[m_Triangles[i + 2]],
+                m_Weights.get());
+        m_Error = std::max(m_Error, candidate.second);
+    }
+}
+
+void Rtin::Split(
+    const glm::ivec2 a, const glm::ivec2 b, const glm::ivec2 c,
+    const float maxError)
+{
+    // c is the right angle, ab the hypotenuse
+    const glm::ivec2 m = (a + b) / 2;
+    const bool leaf = std::abs(a.x - c.x) + std::abs(a.y - c.y) <= 1;
+    const float e = leaf ? 0 : m_Errors[int64_t(m.y) * m_Size + m.x];
+    if (e > maxError) {
+        Split(c, a, m, maxError);
+        Split(b, c, m, maxError);
+        return;
+    }
+
+    // same winding as the triangulator
+    const int ia = AddPoint(a);
+    const int ib = AddPoint(b);
+    const int ic = AddPoint(c);
+    const glm::ivec2 ab = b - a;
+    const glm::ivec2 ac = c - a;
+    m_Triangles.push_back(ia);
+    if (int64_t(ab.x) * ac.y - int64_t(ab.y) * ac.x < 0) {
+        m_Triangles.push_back(ib);
+        m_Triangles.push_back(ic);
+    } else {
+        m_Triangles.push_back(ic);
+        m_Triangles.push_back(ib);
+    }
+}
+
+std::vector<int> Rtin::Boundary() const {
+    // every vertex on the border of the grid is a boundary point, so walk
+    // around the border instead of the mesh
+    std::vector<int> boundary;
+    const int max = m_Size - 1;
+    const auto add = [this, &boundary](const int x, const int y) {
+        const int i = m_Indexes[int64_t(y) * m_Size + x];
+        if (i >= 0) {
+            boundary.push_back(i);
+        }
+    };
+    for (int x = 0; x < max; x++) {
+        add(x, 0);
+    }
+    for (int y = 0; y < max; y++) {
+        add(max, y);
+    }
+    for (int x = max; x > 0; x--) {
+        add(x, max);
+    }
+    for (int y = max; y > 0; y--) {
+        add(0, y);
+    }
+    return boundary;
+}
+
+int Rtin::AddPoint(const glm::ivec2 point) {
+    int &i = m_Indexes[int64_t(point.y) * m_Size + point.x];
+    if (i < 0) {
+        i = m_Points.size();
+        m_Points.push_back(point);
+    }
+    return i;
+}
+
+std::vector<glm::vec3> Rtin::Points(const float zScale) const {
+    std::vector<glm::vec3> points;
+    points.reserve(m_Points.size());
+    const int h1 = m_Size - 1;
+    for (const glm::ivec2 &p : m_Points) {
+        points.emplace_back(p.x, h1 - p.y, m_Heightmap->At(p.x, p.y) * zScale);
+    }
+    return points;
+}
+
+Rtin::MeshView::MeshView(const Rtin &rtin, const float zScale) :
+    m_Rtin(rtin)
+{
+    m_Heights.reserve(rtin.m_Points.size());
+    for (const glm::ivec2 &p : rtin.m_Points) {
+        m_Heights.push_back(rtin.m_Heightmap->At(p) * zScale);
+    }
+}
+
+std::vector<glm::ivec3> Rtin::Triangles() const {
+    std::vector<glm::ivec3> triangles;
+    triangles.reserve(m_Triangles.size() / 3);
+    for (int i = 0; i < m_Triangles.size(); i += 3) {
+        triangles.emplace_back(
+            m_Triangles[i + 0],
+            m_Triangles[i + 1],
+            m_Triangles[i + 2]);
+    }
+    return triangles;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <memory>
+#include <vector>
+
+#include "heightmap.h"
+#include "mesh.h"
+
+// right-triangulated irregular network: the error of every possible split
+// is computed once, after which a mesh can be extracted for any max error
+// in time proportional to its size
+class Rtin {
+public:
+    // the heightmap must be square, with a size of 2^k + 1; errors are
+    // scaled by the optional per-pixel weights
+    Rtin(
+        const std::shared_ptr<Heightmap> &heightmap,
+        const std::shared_ptr<Heightmap> &weights);
+
+    static bool ValidSize(const int width, const int height);
+
+    // replaces the current mesh with one for the given max error. Splits
+    // only look at their midpoints, so the mesh can be off by a bit more
+    // than maxError elsewhere
+    void Extract(const float maxError);
+
+    int NumPoints() const {
+        return m_Points.size();
+    }
+
+    int NumTriangles() const {
+        return m_Triangles.size() / 3;
+    }
+
+    // the true max error of the extracted mesh, over all its pixels
+    float Error() const {
+        return m_Error;
+    }
+
+    std::vector<glm::vec3> Points(const float zScale) const;
+
+    std::vector<glm::ivec3> Triangles() const;
+
+    // indexes of the points along the outer boundary, in order
+    std::vector<int> Boundary() const;
+
+    // the extracted mesh, read in place apart from the scaled heights,
+    // which are looked up ahead of time
+    class MeshView : public Mesh {
+    public:
+        MeshView(const Rtin &rtin, const float zScale);
+
+        int NumPoints() const override {
+            return m_Rtin.m_Points.size();
+        }
+
+        int NumTriangles() const override {
+            return m_Rtin.m_Triangles.size() / 3;
+        }
+
+        glm::vec3 Point(const int i) const override {
+            const glm::ivec2 p = m_Rtin.m_Points[i];
+            return glm::vec3(p.x, m_Rtin.m_Size - 1 - p.y, m_Heights[i]);
+        }
+
+        glm::ivec3 Triangle(const int i) const override {
+            const int *t = &m_Rtin.m_Triangles[i * 3];
+            return glm::ivec3(t[0], t[1], t[2]);
+        }
+
+    private:
+        const Rtin &m_Rtin;
+        std::vector<float> m_Heights;
+    };
+
+private:
+    void ComputeErrors();
+
+    void Split(
+        const glm::ivec2 a, const glm::ivec2 b, const glm::ivec2 c,
+        const float maxError);
+
+    int AddPoint(const glm::ivec2 point);
+
+    std::shared_ptr<Heightmap> m_Heightmap;
+    std::shared_ptr<Heightmap> m_Weights;
+    int m_Size;
+
+    std::vector<float> m_Errors;
+    std::vector<int> m_Indexes;
+
+    std::vector<glm::ivec2> m_Points;
+    std::vector<int> m_Triangles;
+    float m_Error;
+};
@@ -0,0 +1,41 @@
+#include "seeds.h"
+
+#include <fstream>
+#include <sstream>
+
+// each non-empty line holds either a point "x y" or a breakline segment
+// "x0 y0 x1 y1" in pixel coordinates; lines starting with # are ignored
+bool LoadSeeds(
+    const std::string &path,
+    std::vector<glm::ivec2> &points,
+    std::vector<std::pair<glm::ivec2, glm::ivec2>> &lines)
+{
+    std::ifstream file(path);
+    if (!file) {
+        return false;
+    }
+
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        std::istringstream ss(line);
+        std::vector<int> values;
+        int value;
+        while (ss >> value) {
+            values.push_back(value);
+        }
+        if (values.size() == 2) {
+            points.emplace_back(values[0], values[1]);
+        } else if (values.size() == 4) {
+            lines.emplace_back(
+                glm::ivec2(values[0], values[1]),
+                glm::ivec2(values[2], values[3]));
+        } else if (!values.empty()) {
+            return false;
+        }
+    }
+
+    return true;
+}
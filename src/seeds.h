@@ -0,0 +1,11 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <string>
+#include <utility>
+#include <vector>
+
+bool LoadSeeds(
+    const std::string &path,
+    std::vector<glm::ivec2> &points,
+    std::vector<std::pair<glm::ivec2, glm::ivec2>> &lines);
@@ -2,39 +2,43 @@
 
 #define GLM_ENABLE_EXPERIMENTAL
 
+#include <algorithm>
 #include <fstream>
 #include <glm/gtx/normal.hpp>
 #include <cstring>
 
-void SaveBinarySTL(
-    const std::string &path,
-    const std::vector<glm::vec3> &points,
-    const std::vector<glm::ivec3> &triangles)
-{
+void SaveBinarySTL(const std::string &path, const Mesh &mesh) {
     // TODO: properly handle endian-ness
 
-    const uint64_t numBytes = uint64_t(triangles.size()) * 50 + 84;
-    char *dst = (char *)calloc(numBytes, 1);
-
-    const uint32_t count = triangles.size();
-    memcpy(dst + 80, &count, 4);
-
-    for (uint32_t i = 0; i < triangles.size(); i++) {
-        const glm::ivec3 t = triangles[i];
-        const glm::vec3 p0 = points[t.x];
-        const glm::vec3 p1 = points[t.y];
-        const glm::vec3 p2 = points[t.z];
-        const glm::vec3 normal = glm::triangleNormal(p0, p1, p2);
-        const uint64_t idx = 84 + i * 50;
-        memcpy(dst + idx, &normal, 12);
-        memcpy(dst + idx + 12, &p0, 12);
-        memcpy(dst + idx + 24, &p1, 12);
-        memcpy(dst + idx + 36, &p2, 12);
-    }
+    // triangles are written in chunks, so the file never has to be held in
+    // memory all at once
+    const uint32_t chunkSize = 1 << 16;
+    std::vector<char> buf(uint64_t(std::min<size_t>(mesh.NumTriangles(), chunkSize)) * 50 + 84);
 
     std::fstream file(path, std::ios::out | std::ios::binary);
-    file.write(dst, numBytes);
-    file.close();
 
-    free(dst);
+    const uint32_t count = mesh.NumTriangles();
+    memset(buf.data(), 0, 84);
+    memcpy(buf.data() + 80, &count, 4);
+    file.write(buf.data(), 84);
+
+    for (uint32_t i0 = 0; i0 < count; i0 += chunkSize) {
+        const uint32_t n = std::min(count - i0, chunkSize);
+        memset(buf.data(), 0, uint64_t(n) * 50);
+        for (uint32_t i = 0; i < n; i++) {
+            const glm::ivec3 t = mesh.Triangle(i0 + i);
+            const glm::vec3 p0 = mesh.Point(t.x);
+            const glm::vec3 p1 = mesh.Point(t.y);
+            const glm::vec3 p2 = mesh.Point(t.z);
+            const glm::vec3 normal = glm::triangleNormal(p0, p1, p2);
+            const uint64_t idx = uint64_t(i) * 50;
+            memcpy(buf.data() + idx, &normal, 12);
+            memcpy(buf.data() + idx + 12, &p0, 12);
+            memcpy(buf.data() + idx + 24, &p1, 12);
+            memcpy(buf.data() + idx + 36, &p2, 12);
+        }
+        file.write(buf.data(), uint64_t(n) * 50);
+    }
+
+    file.close();
 }
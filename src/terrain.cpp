@@ -0,0 +1,166 @@
+#include "terrain.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+namespace {
+
+// quantized-mesh is little-endian: values are appended least significant
+// byte first, whatever the byte order of the host
+void PutBytes(std::vector<char> &buf, const uint64_t bits, const int size) {
+    for (int i = 0; i < size; i++) {
+        buf.push_back(char(bits >> (i * 8)));
+    }
+}
+
+void Put(std::vector<char> &buf, const uint16_t value) {
+    PutBytes(buf, value, 2);
+}
+
+void Put(std::vector<char> &buf, const uint32_t value) {
+    PutBytes(buf, value, 4);
+}
+
+void Put(std::vector<char> &buf, const float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, 4);
+    PutBytes(buf, bits, 4);
+}
+
+void Put(std::vector<char> &buf, const double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, 8);
+    PutBytes(buf, bits, 8);
+}
+
+void Put(std::vector<char> &buf, const glm::dvec3 &value) {
+    for (int i = 0; i < 3; i++) {
+        Put(buf, value[i]);
+    }
+}
+
+}
+
+void SaveQuantizedMesh(const std::string &path, const Mesh &mesh) {
+    const int numPoints = mesh.NumPoints();
+    const int numTriangles = mesh.NumTriangles();
+
+    // number vertices in order of first use, as high-water mark encoding
+    // requires
+    std::vector<int> indexes(numPoints, -1);
+    std::vector<int> points;
+    points.reserve(numPoints);
+    for (int i = 0; i < numTriangles; i++) {
+        const glm::ivec3 t = mesh.Triangle(i);
+        for (int j = 0; j < 3; j++) {
+            if (indexes[t[j]] < 0) {
+                indexes[t[j]] = points.size();
+                points.push_back(t[j]);
+            }
+        }
+    }
+    const uint32_t vertexCount = points.size();
+
+    // bounds
+    glm::vec3 lo(0);
+    glm::vec3 hi(0);
+    for (uint32_t i = 0; i < vertexCount; i++) {
+        const glm::vec3 p = mesh.Point(points[i]);
+        lo = i ? glm::min(lo, p) : p;
+        hi = i ? glm::max(hi, p) : p;
+    }
+    const glm::vec3 size = hi - lo;
+
+    std::vector<char> buf;
+
+    std::fstream file(path, std::ios::out | std::ios::binary);
+
+    // written out whenever it gets large
+    const auto flush = [&buf, &file](const bool force) {
+        if (force || buf.size() >= (1 << 20)) {
+            file.write(buf.data(), buf.size());
+            buf.clear();
+        }
+    };
+
+    // header: center, height range, bounding sphere and horizon occlusion
+    // point (which is just the center here)
+    const glm::dvec3 center = (glm::dvec3(lo) + glm::dvec3(hi)) * 0.5;
+    const double radius = glm::length(glm::dvec3(size)) * 0.5;
+    Put(buf, center);
+    Put(buf, lo.z);
+    Put(buf, hi.z);
+    Put(buf, center);
+    Put(buf, radius);
+    Put(buf, center);
+
+    // vertex data: u, v and height as zigzag encoded deltas, each in
+    // 0..32767 across the bounds
+    Put(buf, vertexCount);
+    for (int axis = 0; axis < 3; axis++) {
+        const float scale = size[axis] > 0 ? 32767 / size[axis] : 0;
+        int prev = 0;
+        for (uint32_t i = 0; i < vertexCount; i++) {
+            const glm::vec3 p = mesh.Point(points[i]);
+            const int value = std::round((p[axis] - lo[axis]) * scale);
+            const int delta = value - prev;
+            const uint16_t code = (uint32_t(delta) << 1) ^ (delta >> 31);
+            Put(buf, code);
+            prev = value;
+            flush(false);
+        }
+    }
+
+    // indices are 32 bit, and 4 byte aligned, for more than 65536 vertices
+    const bool wide = vertexCount > 65536;
+    const auto putIndex = [&buf, wide](const uint32_t index) {
+        if (wide) {
+            Put(buf, index);
+        } else {
+            Put(buf, uint16_t(index));
+        }
+    };
+    if (wide && vertexCount % 2 == 1) {
+        Put(buf, uint16_t(0));
+    }
+
+    // triangle indices, high-water mark encoded
+    const uint32_t triangleCount = numTriangles;
+    Put(buf, triangleCount);
+    uint32_t highest = 0;
+    for (int i = 0; i < numTriangles; i++) {
+        const glm::ivec3 t = mesh.Triangle(i);
+        for (int j = 0; j < 3; j++) {
+            const uint32_t index = indexes[t[j]];
+            putIndex(highest - index);
+            if (index == highest) {
+                highest++;
+            }
+        }
+        flush(false);
+    }
+
+    // vertices on the west, south, east and north edges
+    for (int edge = 0; edge < 4; edge++) {
+        const int axis = edge % 2;
+        const float value = edge < 2 ? lo[axis] : hi[axis];
+        std::vector<uint32_t> edgeIndexes;
+        for (uint32_t i = 0; i < vertexCount; i++) {
+            if (mesh.Point(points[i])[axis] == value) {
+                edgeIndexes.push_back(i);
+            }
+        }
+        const uint32_t count = edgeIndexes.size();
+        Put(buf, count);
+        for (const uint32_t index : edgeIndexes) {
+            putIndex(index);
+        }
+        flush(false);
+    }
+
+    flush(true);
+    file.close();
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <string>
+
+#include "mesh.h"
+
+// writes a mesh in the quantized-mesh 1.0 terrain format: vertices are
+// quantized to 16 bits within the bounds of the mesh and delta + zigzag
+// encoded, and indices use high-water mark encoding. The header holds the
+// mesh's own (local) coordinates, since heightmaps are not georeferenced
+void SaveQuantizedMesh(const std::string &path, const Mesh &mesh);
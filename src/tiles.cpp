@@ -0,0 +1,152 @@
+#include "tiles.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <sys/stat.h>
+#include <thread>
+
+#include "png.h"
+
+namespace {
+
+void MakeDirectory(const std::string &path) {
+    mkdir(path.c_str(), 0755);
+}
+
+}
+
+TilePyramid::TilePyramid(
+    const std::string &dir,
+    const int width, const int height, const int channels,
+    const int tileSize, const int numThreads) :
+    m_Dir(dir),
+    m_Channels(channels),
+    m_TileSize(tileSize),
+    m_NumThreads(numThreads > 0 ?
+        numThreads : int(std::thread::hardware_concurrency()))
+{
+    // the highest zoom level is the first one whose tiles cover the image
+    int maxZoom = 0;
+    while ((int64_t(tileSize) << maxZoom) < std::max(width, height)) {
+        maxZoom++;
+    }
+    m_Levels.resize(maxZoom + 1);
+    int w = width;
+    int h = height;
+    for (int z = maxZoom; z >= 0; z--) {
+        Level &level = m_Levels[z];
+        level.zoom = z;
+        level.width = w;
+        level.height = h;
+        level.rows = 0;
+        w = (w + 1) / 2;
+        h = (h + 1) / 2;
+    }
+
+    // a directory for each column of tiles
+    MakeDirectory(m_Dir);
+    for (const Level &level : m_Levels) {
+        const std::string path = m_Dir + "/" + std::to_string(level.zoom);
+        MakeDirectory(path);
+        const int columns = (level.width + tileSize - 1) / tileSize;
+        for (int x = 0; x < columns; x++) {
+            MakeDirectory(path + "/" + std::to_string(x));
+        }
+    }
+}
+
+void TilePyramid::AddRows(const uint8_t *data, const int rows) {
+    AddRows(MaxZoom(), data, rows);
+}
+
+void TilePyramid::AddRows(const int z, const uint8_t *data, const int rows) {
+    Level &level = m_Levels[z];
+    const size_t stride = size_t(level.width) * m_Channels;
+    level.band.insert(level.band.end(), data, data + stride * rows);
+    level.rows += rows;
+    const int bandRows = level.band.size() / stride;
+    if (bandRows < m_TileSize && level.rows < level.height) {
+        return;
+    }
+
+    // the band is complete: write its tiles, then pass it on to the level
+    // below at half resolution
+    SaveTiles(level, level.rows - bandRows);
+    if (z == 0) {
+        level.band.clear();
+        return;
+    }
+    // each pixel averages a 2x2 block, which repeats the last row or column
+    // of an odd sized level
+    const int width = m_Levels[z - 1].width;
+    const int halfRows = (bandRows + 1) / 2;
+    std::vector<uint8_t> half(size_t(width) * halfRows * m_Channels);
+    for (int y = 0; y < halfRows; y++) {
+        const uint8_t *row0 = &level.band[size_t(y * 2) * stride];
+        const uint8_t *row1 = y * 2 + 1 < bandRows ? row0 + stride : row0;
+        uint8_t *out = &half[size_t(y) * width * m_Channels];
+        for (int x = 0; x < width; x++) {
+            const int x0 = x * 2 * m_Channels;
+            const int x1 = std::min(x * 2 + 1, level.width - 1) * m_Channels;
+            for (int c = 0; c < m_Channels; c++) {
+                out[x * m_Channels + c] = (
+                    row0[x0 + c] + row0[x1 + c] +
+                    row1[x0 + c] + row1[x1 + c] + 2) / 4;
+            }
+        }
+    }
+    level.band.clear();
+    AddRows(z - 1, half.data(), halfRows);
+}
+
+void TilePyramid::SaveTiles(const Level &level, const int y) const {
+    const int rows = level.band.size() / (size_t(level.width) * m_Channels);
+    const int columns = (level.width + m_TileSize - 1) / m_TileSize;
+    const std::string path = m_Dir + "/" + std::to_string(level.zoom) + "/";
+    const std::string name = "/" + std::to_string(y / m_TileSize) + ".png";
+
+    std::atomic<int> next(0);
+    const auto work = [&]() {
+        std::vector<uint8_t> tile;
+        for (int tx = next++; tx < columns; tx = next++) {
+            const int x0 = tx * m_TileSize;
+            const int cols = std::min(m_TileSize, level.width - x0);
+            // tiles along the right and bottom edges get an alpha channel,
+            // transparent outside the image
+            const bool partial = cols < m_TileSize || rows < m_TileSize;
+            const int channels =
+                partial && m_Channels % 2 == 1 ? m_Channels + 1 : m_Channels;
+            tile.assign(size_t(m_TileSize) * m_TileSize * channels, 0);
+            for (int ty = 0; ty < rows; ty++) {
+                const uint8_t *src =
+                    &level.band[(size_t(ty) * level.width + x0) * m_Channels];
+                uint8_t *dst = &tile[size_t(ty) * m_TileSize * channels];
+                if (channels == m_Channels) {
+                    std::memcpy(dst, src, cols * m_Channels);
+                    continue;
+                }
+                for (int x = 0; x < cols; x++) {
+                    std::memcpy(dst + x * channels, src + x * m_Channels, m_Channels);
+                    dst[x * channels + m_Channels] = 255;
+                }
+            }
+            SavePNG(
+                path + std::to_string(tx) + name,
+                m_TileSize, m_TileSize, channels, tile.data(), 1);
+        }
+    };
+
+    const int numThreads = std::min(m_NumThreads, columns);
+    if (numThreads <= 1) {
+        work();
+        return;
+    }
+    std::vector<std::thread> threads;
+    for (int i = 0; i < numThreads; i++) {
+        threads.emplace_back(work);
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+}
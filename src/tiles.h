@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// writes an image as an xyz tile pyramid, dir/z/x/y.png, with the full
+// resolution image at the highest zoom level and each level below it
+// downsampled from the one above; rows are added a band at a time, so only
+// one band of tiles per level is ever held in memory
+class TilePyramid {
+public:
+    // tiles are encoded on the given number of threads, or all cores for 0
+    TilePyramid(
+        const std::string &dir,
+        const int width, const int height, const int channels,
+        const int tileSize, const int numThreads);
+
+    int MaxZoom() const {
+        return m_Levels.size() - 1;
+    }
+
+    // adds the next rows of the full resolution image, which should be
+    // tileSize rows at a time apart from the last band
+    void AddRows(const uint8_t *data, const int rows);
+
+private:
+    struct Level {
+        int zoom;
+        int width;
+        int height;
+        // rows of the level added so far
+        int rows;
+        // the rows not yet written out as tiles
+        std::vector<uint8_t> band;
+    };
+
+    void AddRows(const int level, const uint8_t *data, const int rows);
+
+    // writes the tiles of a level's band in parallel
+    void SaveTiles(const Level &level, const int y) const;
+
+    std::string m_Dir;
+    int m_Channels;
+    int m_TileSize;
+    int m_NumThreads;
+    std::vector<Level> m_Levels;
+};
@@ -1,28 +1,34 @@
 #include "triangulator.h"
 
 #include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 
 Triangulator::Triangulator(const std::shared_ptr<Heightmap> &heightmap) :
-    m_Heightmap(heightmap) {}
+    Triangulator(
+        heightmap, glm::ivec2(0),
+        glm::ivec2(heightmap->Width() - 1, heightmap->Height() - 1)) {}
+
+Triangulator::Triangulator(
+    const std::shared_ptr<Heightmap> &heightmap,
+    const glm::ivec2 min,
+    const glm::ivec2 max) :
+    m_Heightmap(heightmap),
+    m_Min(min),
+    m_Max(max),
+    m_LockBounds(false),
+    m_DataFlips(false),
+    m_Deadline(std::chrono::steady_clock::time_point::max()) {}
 
 void Triangulator::Run(
     const float maxError,
     const int maxTriangles,
     const int maxPoints)
 {
-    // add points at all four corners
-    const int x0 = 0;
-    const int y0 = 0;
-    const int x1 = m_Heightmap->Width() - 1;
-    const int y1 = m_Heightmap->Height() - 1;
-    const int p0 = AddPoint(glm::ivec2(x0, y0));
-    const int p1 = AddPoint(glm::ivec2(x1, y0));
-    const int p2 = AddPoint(glm::ivec2(x0, y1));
-    const int p3 = AddPoint(glm::ivec2(x1, y1));
-
-    // add initial two triangles
-    const int t0 = AddTriangle(p3, p0, p2, -1, -1, -1, -1);
-    AddTriangle(p0, p3, p1, t0, -1, -1, -1);
+    Initialize();
     Flush();
 
     // helper function to check if triangulation is complete
@@ -37,14 +43,466 @@ void Triangulator::Run(
         if (maxPoints > 0 && NumPoints() >= maxPoints) {
             return true;
         }
+        if (m_Deadline != std::chrono::steady_clock::time_point::max() &&
+            std::chrono::steady_clock::now() >= m_Deadline)
+        {
+            return true;
+        }
         return e == 0;
     };
 
-    while (!done()) {
+    while (1) {
+        Resolve();
+        if (done()) {
+            break;
+        }
         Step();
     }
 }
 
+void Triangulator::RunParallel(
+    const float maxError,
+    const int maxTriangles,
+    const int maxPoints,
+    int numThreads)
+{
+    if (numThreads <= 0) {
+        numThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    // split the bounds into an n x n grid of regions, keeping each region
+    // large enough to be worth triangulating on its own
+    const glm::ivec2 size = m_Max - m_Min;
+    const int maxGrid = std::min(size.x, size.y) / 64;
+    const int n = std::min(int(std::ceil(std::sqrt(numThreads))), maxGrid);
+    if (n <= 1) {
+        Run(maxError, maxTriangles, maxPoints);
+        return;
+    }
+
+    // locked bounds already hold their canonical vertices; the regions
+    // add their corners and more vertices along the bounds, which are
+    // taken out again after merging
+    const int64_t w = m_Heightmap->Width();
+    std::unordered_set<int64_t> canonical;
+    if (m_LockBounds) {
+        for (const glm::ivec2 &p : m_Points) {
+            if (OnBounds(p)) {
+                canonical.insert(p.y * w + p.x);
+            }
+        }
+    }
+
+    std::vector<Triangulator> parts;
+    std::vector<int> partTriangles;
+    std::vector<int> partPoints;
+    for (int j = 0; j < n; j++) {
+        for (int i = 0; i < n; i++) {
+            const glm::ivec2 lo = m_Min + glm::ivec2(
+                int64_t(size.x) * i / n, int64_t(size.y) * j / n);
+            const glm::ivec2 hi = m_Min + glm::ivec2(
+                int64_t(size.x) * (i + 1) / n, int64_t(size.y) * (j + 1) / n);
+            parts.emplace_back(m_Heightmap, lo, hi);
+            parts.back().SetWeights(m_Weights);
+            parts.back().SetPyramid(m_Pyramid);
+            parts.back().SetDataFlips(m_DataFlips);
+            parts.back().SetDeadline(m_Deadline);
+
+            // split triangle and point budgets by area
+            const glm::ivec2 d = hi - lo;
+            const double f = double(d.x) * d.y / (double(size.x) * size.y);
+            partTriangles.push_back(
+                maxTriangles > 0 ? std::max(2, int(maxTriangles * f)) : 0);
+            partPoints.push_back(
+                maxPoints > 0 ? std::max(4, int(maxPoints * f)) : 0);
+        }
+    }
+
+    // vertices already in the triangulation (locked edges, fixed points)
+    // are carried over into every region whose bounds contain them
+    for (Triangulator &part : parts) {
+        for (const glm::ivec2 &p : m_Points) {
+            if (part.InBounds(p)) {
+                part.InsertPoint(p);
+            }
+        }
+    }
+
+    // triangulate regions on a pool of worker threads; every region locks
+    // its bounds to the same canonical vertices as its neighbors, so the
+    // seams line up exactly when the regions are merged
+    std::atomic<int> next(0);
+    const auto worker = [&]() {
+        while (1) {
+            const int i = next++;
+            if (i >= parts.size()) {
+                break;
+            }
+            parts[i].LockBounds(maxError);
+            parts[i].Run(maxError, partTriangles[i], partPoints[i]);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 1; i < std::min(numThreads, int(parts.size())); i++) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+
+    // the regions locked their bounds only so that the seams line up; the
+    // merged bounds stay locked only if they were locked before
+    const bool lockBounds = m_LockBounds;
+    std::unordered_set<int64_t> fixed;
+    fixed.swap(m_Fixed);
+    *this = Triangulator(m_Heightmap, m_Min, m_Max);
+    m_Fixed.swap(fixed);
+    SetWeights(parts[0].m_Weights);
+    SetPyramid(parts[0].m_Pyramid);
+    SetDataFlips(parts[0].m_DataFlips);
+    SetDeadline(parts[0].m_Deadline);
+    Merge(parts);
+    m_LockBounds = lockBounds;
+    if (!lockBounds) {
+        Resolve();
+        return;
+    }
+    std::vector<glm::ivec2> extra;
+    for (const glm::ivec2 &p : m_Points) {
+        if (OnBounds(p) && !canonical.count(p.y * w + p.x)) {
+            extra.push_back(p);
+        }
+    }
+    RemovePoints(extra);
+    Run(maxError, maxTriangles, maxPoints);
+}
+
+void Triangulator::LockBounds(const float maxError) {
+    Initialize();
+    SimplifyBounds(m_Min, m_Max, maxError);
+    m_LockBounds = true;
+}
+
+void Triangulator::SimplifyBounds(
+    const glm::ivec2 min,
+    const glm::ivec2 max,
+    const float maxError)
+{
+    // simplify each side of the bounds between the vertices already on it,
+    // so that neighbors sharing a side (and its existing vertices) agree on
+    // the result; stretches between vertices that stay clear of the
+    // rectangle are left alone
+    const auto lockSide = [this, min, max, maxError](
+        const glm::ivec2 p0, const glm::ivec2 p1)
+    {
+        std::vector<glm::ivec2> stops;
+        for (const glm::ivec2 &p : m_Points) {
+            if (p0.x == p1.x ? p.x == p0.x : p.y == p0.y) {
+                stops.push_back(p);
+            }
+        }
+        std::sort(stops.begin(), stops.end(), [](
+            const glm::ivec2 a, const glm::ivec2 b)
+        {
+            return a.x != b.x ? a.x < b.x : a.y < b.y;
+        });
+        for (int i = 1; i < stops.size(); i++) {
+            const glm::ivec2 a = stops[i - 1];
+            const glm::ivec2 b = stops[i];
+            if (a.x > max.x || a.y > max.y || b.x < min.x || b.y < min.y) {
+                continue;
+            }
+            const auto points = m_Heightmap->SimplifyLine(
+                a, b, maxError, m_Weights.get());
+            for (const glm::ivec2 &p : points) {
+                InsertPoint(p);
+            }
+        }
+    };
+
+    lockSide(glm::ivec2(m_Min.x, m_Min.y), glm::ivec2(m_Max.x, m_Min.y));
+    lockSide(glm::ivec2(m_Min.x, m_Max.y), glm::ivec2(m_Max.x, m_Max.y));
+    lockSide(glm::ivec2(m_Min.x, m_Min.y), glm::ivec2(m_Min.x, m_Max.y));
+    lockSide(glm::ivec2(m_Max.x, m_Min.y), glm::ivec2(m_Max.x, m_Max.y));
+}
+
+void Triangulator::SeedFromCoarse(
+    const int levels,
+    const float maxError,
+    const int maxTriangles,
+    const int maxPoints)
+{
+    if (levels <= 0) {
+        return;
+    }
+
+    // seeding pays off while the triangles are large and scanning them is
+    // what dominates; past about one triangle per 256 pixels the steps on
+    // the coarse level cost more than they save. the seeds also get at most
+    // half of each budget, leaving the rest for refining at full resolution
+    const glm::ivec2 size = m_Max - m_Min;
+    int seedTriangles = std::max<int64_t>(2, int64_t(size.x) * size.y / 256);
+    if (maxTriangles > 0) {
+        seedTriangles = std::min(seedTriangles, std::max(2, maxTriangles / 2));
+    }
+    const int seedPoints = maxPoints > 0 ? std::max(4, maxPoints / 2) : 0;
+
+    // refine a half resolution copy, itself seeded from coarser levels
+    Triangulator coarse(
+        std::make_shared<Heightmap>(m_Heightmap->Downsample()),
+        m_Min / 2, m_Max / 2);
+    if (m_Weights) {
+        coarse.SetWeights(std::make_shared<Heightmap>(m_Weights->Downsample()));
+    }
+    coarse.SetDataFlips(m_DataFlips);
+    coarse.SetDeadline(m_Deadline);
+    coarse.SeedFromCoarse(levels - 1, maxError, seedTriangles, seedPoints);
+    coarse.Run(maxError, seedTriangles, seedPoints);
+
+    // promote its interior vertices; the bounds are left alone so that
+    // they can still be locked or refined at full resolution. points are
+    // inserted in row order so that each point is found close to the last
+    std::vector<glm::ivec2> points = coarse.m_Points;
+    std::sort(points.begin(), points.end(), [](
+        const glm::ivec2 a, const glm::ivec2 b)
+    {
+        return a.y != b.y ? a.y < b.y : a.x < b.x;
+    });
+    Initialize();
+    for (const glm::ivec2 &p : points) {
+        const glm::ivec2 q = p * 2;
+        if (InBounds(q) && !OnBounds(q)) {
+            InsertPoint(q);
+        }
+    }
+}
+
+void Triangulator::Insert(const glm::ivec2 point) {
+    if (InBounds(point)) {
+        m_Fixed.insert(int64_t(point.y) * m_Heightmap->Width() + point.x);
+    }
+    InsertPoint(point);
+}
+
+void Triangulator::InsertPoint(const glm::ivec2 point) {
+    Initialize();
+
+    const int t = Locate(point);
+    if (t < 0) {
+        return;
+    }
+
+    // nothing to do if the point is already a vertex
+    for (int i = 0; i < 3; i++) {
+        if (m_Points[m_Triangles[t * 3 + i]] == point) {
+            return;
+        }
+    }
+
+    QueueRemove(t);
+    Split(t, point);
+}
+
+void Triangulator::Update(
+    const glm::ivec2 min,
+    const glm::ivec2 max,
+    const float maxError,
+    const int maxTriangles,
+    const int maxPoints)
+{
+    Invalidate(min, max, true);
+    if (m_LockBounds) {
+        SimplifyBounds(min, max, maxError);
+    }
+    Run(maxError, maxTriangles, maxPoints);
+}
+
+void Triangulator::UpdateFrame(
+    const Heightmap &frame,
+    const float maxError,
+    const int maxTriangles,
+    const int maxPoints)
+{
+    // compare the frames in blocks; blocks that changed by more than half
+    // the max error are triangulated again from scratch, while blocks with
+    // smaller changes keep their vertices and are only refined further
+    const int size = 32;
+    const int w = m_Heightmap->Width();
+    const int h = m_Heightmap->Height();
+    const int bw = (w + size - 1) / size;
+    const int bh = (h + size - 1) / size;
+    std::vector<int> kinds(bw * bh);
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            const float d = std::abs(frame.At(x, y) - m_Heightmap->At(x, y));
+            int &k = kinds[y / size * bw + x / size];
+            k = std::max(k, d == 0 ? 0 : d <= maxError / 2 ? 1 : 2);
+        }
+    }
+
+    m_Heightmap->Paste(frame, 0, 0);
+
+    // invalidate runs of blocks of the same kind along each row
+    std::vector<std::pair<glm::ivec2, glm::ivec2>> changed;
+    for (int by = 0; by < bh; by++) {
+        for (int bx = 0; bx < bw;) {
+            const int k = kinds[by * bw + bx];
+            int end = bx + 1;
+            while (end < bw && kinds[by * bw + end] == k) {
+                end++;
+            }
+            if (k > 0) {
+                const glm::ivec2 lo(bx * size, by * size);
+                const glm::ivec2 hi(
+                    std::min(end * size, w) - 1,
+                    std::min((by + 1) * size, h) - 1);
+                if (m_Pyramid) {
+                    m_Pyramid->Update(*m_Heightmap, lo, hi);
+                }
+                Invalidate(lo, hi, k == 2);
+                changed.emplace_back(lo, hi);
+            }
+            bx = end;
+        }
+    }
+
+    // locked bounds keep their vertices, but need new ones wherever the
+    // heights along them changed
+    if (m_LockBounds) {
+        for (const auto &rect : changed) {
+            SimplifyBounds(rect.first, rect.second, maxError);
+        }
+    }
+
+    Run(maxError, maxTriangles, maxPoints);
+}
+
+void Triangulator::Invalidate(
+    const glm::ivec2 min,
+    const glm::ivec2 max,
+    const bool removePoints)
+{
+    const glm::ivec2 lo = glm::max(min, m_Min);
+    const glm::ivec2 hi = glm::min(max, m_Max);
+    if (m_Points.empty() || lo.x > hi.x || lo.y > hi.y) {
+        return;
+    }
+
+    const auto touches = [this, lo, hi](const int t) {
+        const glm::ivec2 p0 = m_Points[m_Triangles[t*3+0]];
+        const glm::ivec2 p1 = m_Points[m_Triangles[t*3+1]];
+        const glm::ivec2 p2 = m_Points[m_Triangles[t*3+2]];
+        const glm::ivec2 a = glm::min(glm::min(p0, p1), p2);
+        const glm::ivec2 b = glm::max(glm::max(p0, p1), p2);
+        return a.x <= hi.x && a.y <= hi.y && b.x >= lo.x && b.y >= lo.y;
+    };
+
+    // flood fill from a corner of the rectangle to find the triangles
+    // touching it, moving them to the pending list to be rasterized again;
+    // triangles already pending (from an earlier rectangle) are passed
+    // through, since the fill may need to cross them
+    std::unordered_set<int> visited;
+    std::vector<int> stack;
+    std::vector<glm::ivec2> points;
+    stack.push_back(Locate(lo));
+    while (!stack.empty()) {
+        const int t = stack.back();
+        stack.pop_back();
+        if (!touches(t) || !visited.insert(t).second) {
+            continue;
+        }
+        if (m_QueueIndexes[t] >= -1) {
+            QueueRemove(t);
+            m_QueueIndexes[t] = -2 - int(m_Pending.size());
+            m_Pending.push_back(t);
+        }
+        for (int i = 0; i < 3; i++) {
+            const glm::ivec2 p = m_Points[m_Triangles[t * 3 + i]];
+            if (removePoints && !OnBounds(p) &&
+                p.x >= lo.x && p.y >= lo.y && p.x <= hi.x && p.y <= hi.y &&
+                !m_Fixed.count(int64_t(p.y) * m_Heightmap->Width() + p.x))
+            {
+                points.push_back(p);
+            }
+            const int h = m_Halfedges[t * 3 + i];
+            if (h >= 0) {
+                stack.push_back(h / 3);
+            }
+        }
+    }
+
+    // remove the vertices inside the rectangle, so that it is refined
+    // from scratch
+    RemovePoints(points);
+}
+
+void Triangulator::RemovePoints(std::vector<glm::ivec2> points) {
+    // indexes move around as points are removed, so each one is looked
+    // up again by position
+    std::sort(points.begin(), points.end(), [](
+        const glm::ivec2 a, const glm::ivec2 b)
+    {
+        return a.y != b.y ? a.y < b.y : a.x < b.x;
+    });
+    points.erase(std::unique(points.begin(), points.end()), points.end());
+    std::vector<int> removed;
+    for (const glm::ivec2 &p : points) {
+        const int t = Locate(p);
+        for (int i = 0; i < 3; i++) {
+            const int v = m_Triangles[t * 3 + i];
+            if (m_Points[v] == p) {
+                if (RemovePoint(v, t)) {
+                    removed.push_back(v);
+                }
+                break;
+            }
+        }
+    }
+
+    // fill the slots of removed points with the last points, relabeling
+    // the triangles in one pass
+    const int n = m_Points.size() - removed.size();
+    std::vector<bool> gone(removed.size(), false);
+    std::vector<int> holes;
+    for (const int v : removed) {
+        if (v >= n) {
+            gone[v - n] = true;
+        } else {
+            holes.push_back(v);
+        }
+    }
+    std::vector<int> moved(removed.size(), -1);
+    for (int i = 0, j = 0; i < moved.size(); i++) {
+        if (!gone[i]) {
+            m_Points[holes[j]] = m_Points[n + i];
+            moved[i] = holes[j++];
+        }
+    }
+    for (int &v : m_Triangles) {
+        if (v >= n) {
+            v = moved[v - n];
+        }
+    }
+    m_Points.resize(n);
+}
+
+void Triangulator::Reserve(const int numTriangles) {
+    // no more than a full grid triangulation of the region can produce
+    const glm::ivec2 size = m_Max - m_Min;
+    const size_t n = std::min<int64_t>(
+        numTriangles, int64_t(size.x) * size.y * 2);
+    m_Points.reserve(n / 2 + size_t(size.x) + size.y + 4);
+    m_Triangles.reserve(n * 3);
+    m_Halfedges.reserve(n * 3);
+    m_Candidates.reserve(n);
+    m_Errors.reserve(n);
+    m_Exact.reserve(n);
+    m_QueueIndexes.reserve(n);
+    m_Queue.reserve(n);
+}
+
 float Triangulator::Error() const {
     return m_Errors[m_Queue[0]];
 }
@@ -59,28 +517,90 @@ std::vector<glm::vec3> Triangulator::Points(const float zScale) const {
     return points;
 }
 
+Triangulator::MeshView::MeshView(
+    const Triangulator &triangulator,
+    const float zScale) :
+    m_Triangulator(triangulator),
+    m_H1(triangulator.m_Heightmap->Height() - 1)
+{
+    m_Heights.reserve(triangulator.m_Points.size());
+    for (const glm::ivec2 &p : triangulator.m_Points) {
+        m_Heights.push_back(triangulator.m_Heightmap->At(p) * zScale);
+    }
+}
+
 std::vector<glm::ivec3> Triangulator::Triangles() const {
     std::vector<glm::ivec3> triangles;
-    triangles.reserve(m_Queue.size());
-    for (const int i : m_Queue) {
+    triangles.reserve(m_Triangles.size() / 3);
+    for (int i = 0; i < m_Triangles.size(); i += 3) {
         triangles.emplace_back(
-            m_Triangles[i * 3 + 0],
-            m_Triangles[i * 3 + 1],
-            m_Triangles[i * 3 + 2]);
+            m_Triangles[i + 0],
+            m_Triangles[i + 1],
+            m_Triangles[i + 2]);
     }
     return triangles;
 }
 
+std::vector<int> Triangulator::Boundary() const {
+    std::vector<int> boundary;
+
+    int start = -1;
+    for (int e = 0; e < m_Halfedges.size(); e++) {
+        if (m_Halfedges[e] < 0) {
+            start = e;
+            break;
+        }
+    }
+    if (start < 0) {
+        return boundary;
+    }
+
+    // the next boundary halfedge starts where this one ends: rotate around
+    // that point through the interior halfedges until reaching it
+    int e = start;
+    do {
+        boundary.push_back(m_Triangles[e]);
+        int n = e - e % 3 + (e + 1) % 3;
+        while (m_Halfedges[n] >= 0) {
+            const int b = m_Halfedges[n];
+            n = b - b % 3 + (b + 1) % 3;
+        }
+        e = n;
+    } while (e != start);
+    return boundary;
+}
+
 void Triangulator::Flush() {
+    // in lazy mode, large triangles are queued with a cheap upper bound on
+    // their error and only rasterized once they reach the top of the queue
+    if (m_Pyramid) {
+        int n = 0;
+        for (const int t : m_Pending) {
+            const glm::ivec2 p0 = m_Points[m_Triangles[t*3+0]];
+            const glm::ivec2 p1 = m_Points[m_Triangles[t*3+1]];
+            const glm::ivec2 p2 = m_Points[m_Triangles[t*3+2]];
+            const glm::ivec2 size =
+                glm::max(glm::max(p0, p1), p2) - glm::min(glm::min(p0, p1), p2);
+            if (int64_t(size.x) * size.y < 4096) {
+                // small triangles are cheaper to rasterize right away
+                m_Pending[n++] = t;
+                continue;
+            }
+            m_Errors[t] = m_Pyramid->ErrorBound(
+                p0, p1, p2,
+                m_Heightmap->At(p0), m_Heightmap->At(p1), m_Heightmap->At(p2));
+            m_Exact[t] = false;
+            QueuePush(t);
+        }
+        m_Pending.resize(n);
+    }
+
     for (const int t : m_Pending) {
         // rasterize triangle to find maximum pixel error
-        const auto pair = m_Heightmap->FindCandidate(
+        SetCandidate(t, FindCandidate(
             m_Points[m_Triangles[t*3+0]],
             m_Points[m_Triangles[t*3+1]],
-            m_Points[m_Triangles[t*3+2]]);
-        // update metadata
-        m_Candidates[t] = pair.first;
-        m_Errors[t] = pair.second;
+            m_Points[m_Triangles[t*3+2]]));
         // add triangle to priority queue
         QueuePush(t);
     }
@@ -88,10 +608,212 @@ void Triangulator::Flush() {
     m_Pending.clear();
 }
 
+void Triangulator::Resolve() {
+    // rasterize the top of the queue until it holds an exact error; since
+    // bounds are never below the exact errors, the top is then the true
+    // maximum
+    while (!m_Exact[m_Queue[0]]) {
+        const int t = m_Queue[0];
+        SetCandidate(t, FindCandidate(
+            m_Points[m_Triangles[t*3+0]],
+            m_Points[m_Triangles[t*3+1]],
+            m_Points[m_Triangles[t*3+2]]));
+        QueueDown(0, m_Queue.size());
+    }
+}
+
+std::pair<glm::ivec2, float> Triangulator::FindCandidate(
+    const glm::ivec2 p0,
+    const glm::ivec2 p1,
+    const glm::ivec2 p2) const
+{
+    if (!m_LockBounds) {
+        return m_Heightmap->FindCandidate(p0, p1, p2, m_Weights.get());
+    }
+    // points on locked bounds are never inserted; the bounds were already
+    // simplified to within the error threshold, so only the pixels inside
+    // them are scanned
+    return m_Heightmap->FindCandidate(
+        p0, p1, p2, m_Weights.get(), m_Min + 1, m_Max - 1);
+}
+
+void Triangulator::SetCandidate(
+    const int t, const std::pair<glm::ivec2, float> &pair)
+{
+    // update metadata
+    m_Candidates[t] = pair.first;
+    m_Errors[t] = pair.second;
+    m_Exact[t] = true;
+}
+
+void Triangulator::InsertLine(
+    const glm::ivec2 p0,
+    const glm::ivec2 p1,
+    const float maxError)
+{
+    if (!InBounds(p0) || !InBounds(p1)) {
+        return;
+    }
+    const auto points = m_Heightmap->SimplifyLine(
+        p0, p1, maxError, m_Weights.get());
+    for (const glm::ivec2 &p : points) {
+        Insert(p);
+    }
+}
+
+void Triangulator::Initialize() {
+    if (!m_Points.empty()) {
+        return;
+    }
+
+    // add points at all four corners
+    const int x0 = m_Min.x;
+    const int y0 = m_Min.y;
+    const int x1 = m_Max.x;
+    const int y1 = m_Max.y;
+    const int p0 = AddPoint(glm::ivec2(x0, y0));
+    const int p1 = AddPoint(glm::ivec2(x1, y0));
+    const int p2 = AddPoint(glm::ivec2(x0, y1));
+    const int p3 = AddPoint(glm::ivec2(x1, y1));
+
+    // add initial two triangles
+    const int t0 = AddTriangle(p3, p0, p2, -1, -1, -1, -1);
+    AddTriangle(p0, p3, p1, t0, -1, -1, -1);
+}
+
+void Triangulator::Merge(const std::vector<Triangulator> &parts) {
+    const int64_t w = m_Heightmap->Width();
+
+    // merged indexes of vertices on region bounds, keyed by pixel offset
+    std::unordered_map<int64_t, int> shared;
+
+    // unpaired boundary halfedges, keyed by their endpoints
+    std::unordered_map<int64_t, int> open;
+    const auto key = [](const int64_t a, const int64_t b) {
+        return (a << 32) | b;
+    };
+
+    // reserve exactly, rather than growing by doubling
+    int numTriangles = 0;
+    for (const Triangulator &part : parts) {
+        numTriangles += part.m_QueueIndexes.size();
+    }
+    Reserve(numTriangles);
+
+    for (const Triangulator &part : parts) {
+        // add points, reusing vertices shared with previous regions
+        std::vector<int> index(part.m_Points.size());
+        for (int i = 0; i < part.m_Points.size(); i++) {
+            const glm::ivec2 p = part.m_Points[i];
+            if (part.OnBounds(p)) {
+                const int64_t k = int64_t(p.y) * w + p.x;
+                const auto it = shared.find(k);
+                if (it != shared.end()) {
+                    index[i] = it->second;
+                    continue;
+                }
+                shared[k] = m_Points.size();
+            }
+            index[i] = AddPoint(p);
+        }
+
+        // add triangles, offsetting halfedges
+        const int e0 = m_Triangles.size();
+        for (int e = 0; e < part.m_Triangles.size(); e++) {
+            const int h = part.m_Halfedges[e];
+            m_Triangles.push_back(index[part.m_Triangles[e]]);
+            m_Halfedges.push_back(h < 0 ? -1 : h + e0);
+        }
+        for (int t = 0; t < part.m_Candidates.size(); t++) {
+            m_Candidates.push_back(part.m_Candidates[t]);
+            m_Errors.push_back(part.m_Errors[t]);
+            m_Exact.push_back(part.m_Exact[t]);
+            m_QueueIndexes.push_back(-1);
+        }
+
+        // link boundary halfedges with their twins along the seams
+        for (int e = e0; e < m_Triangles.size(); e++) {
+            if (m_Halfedges[e] >= 0) {
+                continue;
+            }
+            const int a = m_Triangles[e];
+            const int b = m_Triangles[e - e % 3 + (e + 1) % 3];
+            const auto it = open.find(key(b, a));
+            if (it != open.end()) {
+                m_Halfedges[e] = it->second;
+                m_Halfedges[it->second] = e;
+                open.erase(it);
+            } else {
+                open[key(a, b)] = e;
+            }
+        }
+    }
+
+    for (int t = 0; t < m_Candidates.size(); t++) {
+        QueuePush(t);
+    }
+}
+
+int Triangulator::Locate(const glm::ivec2 p) const {
+    const auto edge = [](
+        const glm::ivec2 a, const glm::ivec2 b, const glm::ivec2 c)
+    {
+        return int64_t(b.x - c.x) * (a.y - c.y) -
+            int64_t(b.y - c.y) * (a.x - c.x);
+    };
+
+    const auto inside = [this, &edge](const int t, const glm::ivec2 p) {
+        for (int i = 0; i < 3; i++) {
+            const glm::ivec2 a = m_Points[m_Triangles[t * 3 + i]];
+            const glm::ivec2 b = m_Points[m_Triangles[t * 3 + (i + 1) % 3]];
+            if (edge(a, b, p) < 0) {
+                return i;
+            }
+        }
+        return -1;
+    };
+
+    // walk towards the point, starting from the most recent triangle,
+    // which is usually close by when points are inserted in order
+    const int n = m_Triangles.size() / 3;
+    int t = m_Pending.empty() ? n - 1 : m_Pending.back();
+    for (int i = 0; i < n; i++) {
+        const int j = inside(t, p);
+        if (j < 0) {
+            return t;
+        }
+        const int h = m_Halfedges[t * 3 + j];
+        if (h < 0) {
+            // outside of the triangulation
+            return -1;
+        }
+        t = h / 3;
+    }
+
+    // the walk can cycle in non-Delaunay triangulations, fall back to a scan
+    for (t = 0; t < n; t++) {
+        if (inside(t, p) < 0) {
+            return t;
+        }
+    }
+    return -1;
+}
+
 void Triangulator::Step() {
     // pop triangle with highest error from priority queue
     const int t = QueuePop();
 
+    // split it at its candidate point
+    Split(t, m_Candidates[t]);
+
+    if (m_DataFlips) {
+        FlipByError(m_Points.size() - 1);
+    }
+
+    Flush();
+}
+
+void Triangulator::Split(const int t, const glm::ivec2 p) {
     const int e0 = t * 3 + 0;
     const int e1 = t * 3 + 1;
     const int e2 = t * 3 + 2;
@@ -103,7 +825,6 @@ void Triangulator::Step() {
     const glm::ivec2 a = m_Points[p0];
     const glm::ivec2 b = m_Points[p1];
     const glm::ivec2 c = m_Points[p2];
-    const glm::ivec2 p = m_Candidates[t];
 
     const int pn = AddPoint(p);
 
@@ -172,8 +893,6 @@ void Triangulator::Step() {
         Legalize(t1);
         Legalize(t2);
     }
-
-    Flush();
 }
 
 int Triangulator::AddPoint(const glm::ivec2 point) {
@@ -201,6 +920,7 @@ int Triangulator::AddTriangle(
         // add triangle metadata
         m_Candidates.emplace_back(0);
         m_Errors.push_back(0);
+        m_Exact.push_back(false);
         m_QueueIndexes.push_back(-1);
     } else {
         // set triangle vertices
@@ -226,6 +946,7 @@ int Triangulator::AddTriangle(
 
     // add triangle to pending queue for later rasterization
     const int t = e / 3;
+    m_QueueIndexes[t] = -2 - int(m_Pending.size());
     m_Pending.push_back(t);
 
     // return first halfedge index
@@ -235,7 +956,7 @@ int Triangulator::AddTriangle(
 void Triangulator::Legalize(const int a) {
     // if the pair of triangles doesn't satisfy the Delaunay condition
     // (p1 is inside the circumcircle of [p0, pl, pr]), flip them,
-    // then do the same check/flip recursively for the new pair of triangles
+    // then do the same check/flip for the new pair of triangles
     //
     //           pl                    pl
     //          /||\                  /  \
@@ -247,6 +968,9 @@ void Triangulator::Legalize(const int a) {
     //       ar\ || /br             b\    /br
     //          \||/                  \  /
     //           pr                    pr
+    //
+    // edges still to be checked are kept on an explicit stack rather than
+    // the call stack, so long flip cascades can't overflow it
 
     const auto inCircle = [](
         const glm::ivec2 a, const glm::ivec2 b, const glm::ivec2 c,
@@ -261,15 +985,61 @@ void Triangulator::Legalize(const int a) {
         const int64_t ap = dx * dx + dy * dy;
         const int64_t bp = ex * ex + ey * ey;
         const int64_t cp = fx * fx + fy * fy;
+        // exact while the terms fit in 64 bits, i.e. for deltas below
+        // 2^14; the few larger triangles of very big heightmaps use 128-bit
+        // math, which is exact for deltas below 2^30, so that cocircular
+        // grid points always flip the same way
+        const int64_t m = std::max(
+            std::max(std::max(std::abs(dx), std::abs(dy)),
+                std::max(std::abs(ex), std::abs(ey))),
+            std::max(std::abs(fx), std::abs(fy)));
+        if (m >= 1 << 14) {
+            using int128 = __int128;
+            return dx * (ey * int128(cp) - int128(bp) * fy) -
+                dy * (ex * int128(cp) - int128(bp) * fx) +
+                int128(ap) * (ex * fy - ey * fx) < 0;
+        }
         return dx*(ey*cp-bp*fy)-dy*(ex*cp-bp*fx)+ap*(ex*fy-ey*fx) < 0;
     };
 
-    const int b = m_Halfedges[a];
+    m_LegalizeStack.push_back(a);
 
-    if (b < 0) {
-        return;
+    while (!m_LegalizeStack.empty()) {
+        const int a = m_LegalizeStack.back();
+        m_LegalizeStack.pop_back();
+
+        const int b = m_Halfedges[a];
+
+        if (b < 0) {
+            continue;
+        }
+
+        const int a0 = a - a % 3;
+        const int b0 = b - b % 3;
+        const int al = a0 + (a + 1) % 3;
+        const int ar = a0 + (a + 2) % 3;
+        const int bl = b0 + (b + 2) % 3;
+        const int p0 = m_Triangles[ar];
+        const int pr = m_Triangles[a];
+        const int pl = m_Triangles[al];
+        const int p1 = m_Triangles[bl];
+
+        if (!inCircle(m_Points[p0], m_Points[pr], m_Points[pl], m_Points[p1])) {
+            continue;
+        }
+
+        Flip(a);
+
+        // pushed in reverse so that a0 + 1 is checked first
+        m_LegalizeStack.push_back(b0 + 2);
+        m_LegalizeStack.push_back(a0 + 1);
     }
+}
 
+void Triangulator::Flip(const int a) {
+    // replaces the pair of triangles sharing halfedge a with
+    // [p0, p1, pl] and [p1, p0, pr], in the same slots (see Legalize)
+    const int b = m_Halfedges[a];
     const int a0 = a - a % 3;
     const int b0 = b - b % 3;
     const int al = a0 + (a + 1) % 3;
@@ -281,10 +1051,6 @@ void Triangulator::Legalize(const int a) {
     const int pl = m_Triangles[al];
     const int p1 = m_Triangles[bl];
 
-    if (!inCircle(m_Points[p0], m_Points[pr], m_Points[pl], m_Points[p1])) {
-        return;
-    }
-
     const int hal = m_Halfedges[al];
     const int har = m_Halfedges[ar];
     const int hbl = m_Halfedges[bl];
@@ -293,11 +1059,256 @@ void Triangulator::Legalize(const int a) {
     QueueRemove(a / 3);
     QueueRemove(b / 3);
 
-    const int t0 = AddTriangle(p0, p1, pl, -1, hbl, hal, a0);
-    const int t1 = AddTriangle(p1, p0, pr, t0, har, hbr, b0);
+    AddTriangle(p0, p1, pl, -1, hbl, hal, a0);
+    AddTriangle(p1, p0, pr, a0, har, hbr, b0);
+}
+
+void Triangulator::FlipByError(const int p) {
+    // flips edges opposite the new point p (see Legalize for the layout,
+    // with p0 = p) when the new pair of triangles has a clearly lower
+    // maximum error than the old pair. every flip adds an edge at p, so
+    // this ends; later insertions may flip edges back for the Delaunay
+    // condition
+
+    const auto orient = [](
+        const glm::ivec2 a, const glm::ivec2 b, const glm::ivec2 c)
+    {
+        return int64_t(b.x - a.x) * (c.y - a.y) -
+            int64_t(b.y - a.y) * (c.x - a.x);
+    };
+
+    // start with the edges opposite p in the triangles around it, which
+    // are all still pending, then rasterize them
+    for (const int t : m_Pending) {
+        for (int i = 0; i < 3; i++) {
+            if (m_Triangles[t * 3 + i] == p) {
+                m_FlipStack.push_back(t * 3 + (i + 1) % 3);
+            }
+        }
+    }
+    Flush();
+
+    while (!m_FlipStack.empty()) {
+        const int a = m_FlipStack.back();
+        m_FlipStack.pop_back();
+
+        const int b = m_Halfedges[a];
+
+        if (b < 0) {
+            continue;
+        }
+
+        const int a0 = a - a % 3;
+        const int b0 = b - b % 3;
+        const int al = a0 + (a + 1) % 3;
+        const int ar = a0 + (a + 2) % 3;
+        const int bl = b0 + (b + 2) % 3;
+        const int p0 = m_Triangles[ar];
+        const int pr = m_Triangles[a];
+        const int pl = m_Triangles[al];
+        const int p1 = m_Triangles[bl];
+
+        // only compare exact errors
+        if (!m_Exact[a / 3] || !m_Exact[b / 3]) {
+            continue;
+        }
+
+        // the quad must be strictly convex to flip
+        const glm::ivec2 q0 = m_Points[p0];
+        const glm::ivec2 q1 = m_Points[p1];
+        const glm::ivec2 ql = m_Points[pl];
+        const glm::ivec2 qr = m_Points[pr];
+        if (orient(q0, q1, ql) >= 0 || orient(q1, q0, qr) >= 0) {
+            continue;
+        }
+
+        const auto c0 = FindCandidate(q0, q1, ql);
+        const auto c1 = FindCandidate(q1, q0, qr);
+        // small gains aren't worth the thinner triangles, which tend to
+        // need more splits later on
+        const float before = std::max(m_Errors[a / 3], m_Errors[b / 3]);
+        if (std::max(c0.second, c1.second) >= before * 0.9f) {
+            continue;
+        }
+
+        Flip(a);
+
+        // both candidates are known already, skip the pending list
+        QueueRemove(a0 / 3);
+        QueueRemove(b0 / 3);
+        SetCandidate(a0 / 3, c0);
+        SetCandidate(b0 / 3, c1);
+        QueuePush(a0 / 3);
+        QueuePush(b0 / 3);
+
+        m_FlipStack.push_back(b0 + 2);
+        m_FlipStack.push_back(a0 + 1);
+    }
+}
+
+bool Triangulator::RemovePoint(const int p, const int t) {
+    // disconnects p, which must be a corner of triangle t, from the
+    // triangulation; its slot in m_Points is left for the caller to reuse
+    const auto next = [](const int e) {
+        return e - e % 3 + (e + 1) % 3;
+    };
+    const auto prev = [](const int e) {
+        return e - e % 3 + (e + 2) % 3;
+    };
+    const auto orient = [](
+        const glm::ivec2 a, const glm::ivec2 b, const glm::ivec2 c)
+    {
+        return int64_t(b.x - a.x) * (c.y - a.y) -
+            int64_t(b.y - a.y) * (c.x - a.x);
+    };
+
+    // collects the halfedges starting at p in order around it. when p is
+    // on the outside of the triangulation, the first one is on the outside
+    // too, and so is the last triangle's edge into p
+    std::vector<int> edges;
+    bool outside = false;
+    const auto around = [&](int e) {
+        const int e0 = e;
+        while (m_Halfedges[e] >= 0) {
+            e = next(m_Halfedges[e]);
+            if (e == e0) {
+                break;
+            }
+        }
+        outside = m_Halfedges[e] < 0;
+        const int first = e;
+        edges.clear();
+        do {
+            edges.push_back(e);
+            e = m_Halfedges[prev(e)];
+        } while (e >= 0 && e != first);
+    };
+
+    int e0 = t * 3;
+    while (m_Triangles[e0] != p) {
+        e0++;
+    }
+    around(e0);
+
+    // a point on the outside can only go if it lies on a straight line
+    // between its neighbors there
+    if (outside) {
+        const glm::ivec2 a = m_Points[m_Triangles[prev(edges.back())]];
+        const glm::ivec2 b = m_Points[m_Triangles[next(edges[0])]];
+        if (orient(a, m_Points[p], b) != 0) {
+            return false;
+        }
+    }
+
+    // flip edges away from p until only three triangles (two on the
+    // outside) are left around it (see Legalize for the layout, with
+    // pr = p)
+    while (edges.size() > (outside ? 2 : 3)) {
+        bool flipped = false;
+        for (const int a : edges) {
+            const int b = m_Halfedges[a];
+            if (b < 0) {
+                continue;
+            }
+            const int p0 = m_Triangles[prev(a)];
+            const int pl = m_Triangles[next(a)];
+            const int p1 = m_Triangles[prev(b)];
+            const glm::ivec2 q0 = m_Points[p0];
+            const glm::ivec2 q1 = m_Points[p1];
+            if (orient(q0, q1, m_Points[pl]) < 0 &&
+                orient(q1, q0, m_Points[p]) < 0)
+            {
+                Flip(a);
+                // p stays in the second triangle, at its third corner
+                e0 = b - b % 3 + 2;
+                flipped = true;
+                break;
+            }
+        }
+        if (!flipped) {
+            return false;
+        }
+        around(e0);
+    }
+
+    if (outside) {
+        // replace the last two triangles with one, whose outer edge
+        // passes where p was
+        const int a = m_Triangles[prev(edges[1])];
+        const int b = m_Triangles[next(edges[0])];
+        const int c = m_Triangles[next(edges[1])];
+        const int bc = m_Halfedges[next(edges[0])];
+        const int ca = m_Halfedges[next(edges[1])];
+        const int dead0 = edges[0] / 3;
+        const int dead1 = edges[1] / 3;
+        QueueRemove(dead0);
+        QueueRemove(dead1);
+        const int e = AddTriangle(a, b, c, -1, bc, ca, dead0 * 3);
+        Legalize(e + 1);
+        Legalize(e + 2);
+        RemoveTriangle(dead1);
+        return true;
+    }
+
+    // replace the last three triangles with one, reusing the first slot
+    int outer[3];
+    int dead[3];
+    for (int i = 0; i < 3; i++) {
+        outer[i] = m_Halfedges[next(edges[i])];
+        dead[i] = edges[i] / 3;
+    }
+    const int v0 = m_Triangles[next(edges[0])];
+    const int v1 = m_Triangles[next(edges[1])];
+    const int v2 = m_Triangles[next(edges[2])];
+    for (int i = 0; i < 3; i++) {
+        QueueRemove(dead[i]);
+    }
+    const int e = AddTriangle(
+        v0, v1, v2, outer[0], outer[1], outer[2], dead[0] * 3);
+    Legalize(e + 0);
+    Legalize(e + 1);
+    Legalize(e + 2);
+
+    // drop the unused slots, highest first so that they aren't moved
+    if (dead[1] < dead[2]) {
+        std::swap(dead[1], dead[2]);
+    }
+    RemoveTriangle(dead[1]);
+    RemoveTriangle(dead[2]);
+
+    return true;
+}
 
-    Legalize(t0 + 1);
-    Legalize(t1 + 2);
+void Triangulator::RemoveTriangle(const int t) {
+    // moves the last triangle into slot t, which must be unused
+    QueueRemove(t);
+    const int n = m_QueueIndexes.size() - 1;
+    if (t != n) {
+        for (int i = 0; i < 3; i++) {
+            const int h = m_Halfedges[n * 3 + i];
+            m_Triangles[t * 3 + i] = m_Triangles[n * 3 + i];
+            m_Halfedges[t * 3 + i] = h;
+            if (h >= 0) {
+                m_Halfedges[h] = t * 3 + i;
+            }
+        }
+        m_Candidates[t] = m_Candidates[n];
+        m_Errors[t] = m_Errors[n];
+        m_Exact[t] = m_Exact[n];
+        const int i = m_QueueIndexes[n];
+        m_QueueIndexes[t] = i;
+        if (i >= 0) {
+            m_Queue[i] = t;
+        } else if (i < -1) {
+            m_Pending[-2 - i] = t;
+        }
+    }
+    m_Triangles.resize(n * 3);
+    m_Halfedges.resize(n * 3);
+    m_Candidates.pop_back();
+    m_Errors.pop_back();
+    m_Exact.pop_back();
+    m_QueueIndexes.pop_back();
 }
 
 // priority queue functions
@@ -325,14 +1336,17 @@ int Triangulator::QueuePopBack() {
 
 void Triangulator::QueueRemove(const int t) {
     const int i = m_QueueIndexes[t];
+    if (i < -1) {
+        // pending triangles store -2 - their index in m_Pending
+        const int j = -2 - i;
+        const int u = m_Pending.back();
+        m_Pending[j] = u;
+        m_QueueIndexes[u] = i;
+        m_Pending.pop_back();
+        m_QueueIndexes[t] = -1;
+        return;
+    }
     if (i < 0) {
-        const auto it = std::find(m_Pending.begin(), m_Pending.end(), t);
-        if (it != m_Pending.end()) {
-            std::swap(*it, m_Pending.back());
-            m_Pending.pop_back();
-        } else {
-            // this shouldn't happen!
-        }
         return;
     }
     const int n = m_Queue.size() - 1;
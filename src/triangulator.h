@@ -1,20 +1,128 @@
 #pragma once
 
+#include <chrono>
 #include <glm/glm.hpp>
 #include <memory>
+#include <unordered_set>
 #include <vector>
 
 #include "heightmap.h"
+#include "mesh.h"
+#include "pyramid.h"
 
 class Triangulator {
 public:
     Triangulator(const std::shared_ptr<Heightmap> &heightmap);
 
+    // triangulates only the given (inclusive) rectangle of the heightmap
+    Triangulator(
+        const std::shared_ptr<Heightmap> &heightmap,
+        const glm::ivec2 min,
+        const glm::ivec2 max);
+
+    // scales the error of each pixel, so that areas with higher weights
+    // are refined further; must match the heightmap size
+    void SetWeights(const std::shared_ptr<Heightmap> &weights) {
+        m_Weights = weights;
+    }
+
+    // enables lazy mode, where new triangles are queued with an upper bound
+    // on their error and only rasterized when they reach the top
+    void SetPyramid(const std::shared_ptr<MinMaxPyramid> &pyramid) {
+        m_Pyramid = pyramid;
+    }
+
+    // after each split, also flips edges around the new point whenever
+    // that lowers the larger error of the two triangles sharing the edge
+    void SetDataFlips(const bool enabled) {
+        m_DataFlips = enabled;
+    }
+
+    // stops refinement once the deadline has passed, keeping the mesh
+    // reached so far
+    void SetDeadline(const std::chrono::steady_clock::time_point deadline) {
+        m_Deadline = deadline;
+    }
+
     void Run(
         const float maxError,
         const int maxTriangles,
         const int maxPoints);
 
+    // splits the bounds into regions that are triangulated concurrently
+    // and then merged; numThreads <= 0 uses all available cores
+    void RunParallel(
+        const float maxError,
+        const int maxTriangles,
+        const int maxPoints,
+        int numThreads);
+
+    // inserts canonical vertices along the bounds, simplified to maxError,
+    // and never refines the bounds any further; Update and UpdateFrame only
+    // simplify them again where the heights changed
+    void LockBounds(const float maxError);
+
+    // triangulates a copy of the heightmap downsampled `levels` times
+    // (coarse to fine) and inserts its vertices as starting points; the
+    // copies are only refined while their triangles are large, and within
+    // half of the budgets
+    void SeedFromCoarse(
+        const int levels,
+        const float maxError,
+        const int maxTriangles,
+        const int maxPoints);
+
+    // re-triangulates after the heightmap (and pyramid, if any) changed
+    // within the given (inclusive) rectangle: vertices inside it are
+    // removed, triangles touching it are rasterized again and then the
+    // triangulation is refined as in Run
+    void Update(
+        const glm::ivec2 min,
+        const glm::ivec2 max,
+        const float maxError,
+        const int maxTriangles,
+        const int maxPoints);
+
+    // copies the next frame of a sequence (of the same size) into the
+    // heightmap and updates the triangulation where the frames differ,
+    // keeping the vertices elsewhere
+    void UpdateFrame(
+        const Heightmap &frame,
+        const float maxError,
+        const int maxTriangles,
+        const int maxPoints);
+
+    // marks the triangles touching the (inclusive) rectangle to be
+    // rasterized again by the next Run, optionally removing the vertices
+    // inside it other than fixed points
+    void Invalidate(
+        const glm::ivec2 min,
+        const glm::ivec2 max,
+        const bool removePoints);
+
+    // inserts a fixed point into the triangulation, which is kept through
+    // later updates
+    void Insert(const glm::ivec2 point);
+
+    // inserts fixed points along a breakline, simplified to maxError
+    void InsertLine(
+        const glm::ivec2 p0,
+        const glm::ivec2 p1,
+        const float maxError);
+
+    // approximate bytes of triangulator storage per triangle, including
+    // its share of the vertices
+    static int BytesPerTriangle() {
+        // triangles, halfedges, candidates, errors, queue and queue
+        // indexes, plus half a vertex
+        return 12 + 12 + 8 + 4 + 4 + 4 + 4;
+    }
+
+    // reserves storage for the given number of triangles up front, so that
+    // memory use grows steadily instead of doubling; capped at the number
+    // of triangles the region can hold
+    void Reserve(const int numTriangles);
+
     int NumPoints() const {
         return m_Points.size();
     }
@@ -29,11 +137,86 @@ public:
 
     std::vector<glm::ivec3> Triangles() const;
 
+    // indexes of the points along the outer boundary, in order, found by
+    // walking the halfedges that have no opposite
+    std::vector<int> Boundary() const;
+
+    // the current mesh, read in place; only the scaled heights are looked
+    // up ahead of time, since fetching them from the heightmap for every
+    // triangle corner is slow. Only valid while the triangulator is
+    // unchanged
+    class MeshView : public Mesh {
+    public:
+        MeshView(const Triangulator &triangulator, const float zScale);
+
+        int NumPoints() const override {
+            return m_Triangulator.m_Points.size();
+        }
+
+        int NumTriangles() const override {
+            return m_Triangulator.m_Triangles.size() / 3;
+        }
+
+        glm::vec3 Point(const int i) const override {
+            const glm::ivec2 p = m_Triangulator.m_Points[i];
+            return glm::vec3(p.x, m_H1 - p.y, m_Heights[i]);
+        }
+
+        glm::ivec3 Triangle(const int i) const override {
+            const int *t = &m_Triangulator.m_Triangles[i * 3];
+            return glm::ivec3(t[0], t[1], t[2]);
+        }
+
+    private:
+        const Triangulator &m_Triangulator;
+        std::vector<float> m_Heights;
+        int m_H1;
+    };
+
 private:
+    bool InBounds(const glm::ivec2 p) const {
+        return p.x >= m_Min.x && p.y >= m_Min.y &&
+            p.x <= m_Max.x && p.y <= m_Max.y;
+    }
+
+    bool OnBounds(const glm::ivec2 p) const {
+        return p.x == m_Min.x || p.y == m_Min.y ||
+            p.x == m_Max.x || p.y == m_Max.y;
+    }
+
+    void Initialize();
+
+    // inserts a vertex without fixing it
+    void InsertPoint(const glm::ivec2 point);
+
+    // simplifies the sides of the bounds again between their vertices,
+    // wherever they pass through the (inclusive) rectangle
+    void SimplifyBounds(
+        const glm::ivec2 min,
+        const glm::ivec2 max,
+        const float maxError);
+
+    void Merge(const std::vector<Triangulator> &parts);
+
+    int Locate(const glm::ivec2 p) const;
+
     void Flush();
 
+    void Resolve();
+
+    // finds the pixel of a triangle with the largest error, skipping the
+    // locked bounds
+    std::pair<glm::ivec2, float> FindCandidate(
+        const glm::ivec2 p0,
+        const glm::ivec2 p1,
+        const glm::ivec2 p2) const;
+
+    void SetCandidate(const int t, const std::pair<glm::ivec2, float> &pair);
+
     void Step();
 
+    void Split(const int t, const glm::ivec2 p);
+
     int AddPoint(const glm::ivec2 point);
 
     int AddTriangle(
@@ -43,6 +226,21 @@ private:
 
     void Legalize(const int a);
 
+    void Flip(const int a);
+
+    // disconnects p, which must be a corner of triangle t; points on the
+    // outside are only removed where the outside runs straight through them
+    bool RemovePoint(const int p, const int t);
+
+    // removes the vertices at the given positions where possible, filling
+    // their slots with the last points
+    void RemovePoints(std::vector<glm::ivec2> points);
+
+    void RemoveTriangle(const int t);
+
+    // must be called while the triangles around p are still pending
+    void FlipByError(const int p);
+
     void QueuePush(const int t);
     int QueuePop();
     int QueuePopBack();
@@ -53,17 +251,32 @@ private:
     bool QueueDown(const int i0, const int n);
 
     std::shared_ptr<Heightmap> m_Heightmap;
+    std::shared_ptr<Heightmap> m_Weights;
+    std::shared_ptr<MinMaxPyramid> m_Pyramid;
+
+    glm::ivec2 m_Min;
+    glm::ivec2 m_Max;
+    bool m_LockBounds;
+    bool m_DataFlips;
+    std::chrono::steady_clock::time_point m_Deadline;
 
     std::vector<glm::ivec2> m_Points;
 
+    // pixel offsets of fixed points
+    std::unordered_set<int64_t> m_Fixed;
+
     std::vector<int> m_Triangles;
     std::vector<int> m_Halfedges;
 
     std::vector<glm::ivec2> m_Candidates;
     std::vector<float> m_Errors;
+    std::vector<bool> m_Exact;
     std::vector<int> m_QueueIndexes;
 
     std::vector<int> m_Queue;
 
     std::vector<int> m_Pending;
+
+    std::vector<int> m_LegalizeStack;
+    std::vector<int> m_FlipStack;
 };